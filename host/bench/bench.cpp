@@ -0,0 +1,403 @@
+/**
+ * @file bench.cpp
+ * @brief Runs the sketch on the simulated board through one scenario, prints what it measured and checks bounds.
+ *
+ * usage: bench fill TRACE | buttons TIMELINE | idle | settings | recovery
+ *
+ * fill replays a recorded fill and checks the cutoff switches at the target, buttons presses through the menu
+ * and measures how long each press takes to show, idle measures the bus and EEPROM traffic of a still tank,
+ * settings the EEPROM wear of saving a profile, and recovery checks the display comes back after the bus fails.
+ * The exit status is non-zero if a bound is missed.
+ * The sketch is compiled into this file, so the benchmarks reach its state as the firmware itself does.
+ */
+#include "mvm_host.cpp"
+
+#include "hal.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#define STEADY_ECHO 4000         // us, a tank about two thirds full
+#define MAX_LOOP_TIME 10000      // us a loop pass may block on the hardware, well inside the task deadlines
+#define MAX_RECOVERY_TIME 20000  // us of a pass that sets the display up again, 11 ms of it the reset pulse
+#define MAX_INPUT_LATENCY 150000 // us from a press to its change being on the panel
+#define MAX_CUTOFF_DELAY 300000  // us from the level reaching the target to the cutoff closing
+#define MAX_IDLE_BYTES 100       // I2C bytes a second to the panel while nothing changes
+#define SETTLE_TIME 5000000ULL   // us for the level estimate to settle before a measurement
+#define BUS_TIMEOUT 5            // what endTransmission() returns when a transfer hits the Wire timeout
+
+namespace
+{
+
+unsigned long long loopTimeSum = 0; // us the measured passes blocked, in total
+uint16_t loopTimeMax = 0;
+unsigned long loopPasses = 0;
+bool failed = false;
+unsigned long changesBefore = 0;    // panel changes when the last press went down
+unsigned long long firstChange = 0; // us of the loop pass that first changed the panel after it, 0 until then
+
+/**
+ * @brief Collects the loop time of the pass that just ran.
+ */
+void collectLoopTime()
+{
+    loopTimeSum += stats.loopTime;
+    loopTimeMax = max(loopTimeMax, stats.loopTime);
+    loopPasses++;
+}
+
+/**
+ * @brief Collects the loop time, and notes the first pass that changes the panel after a press.
+ */
+void watchPanel()
+{
+    collectLoopTime();
+    if (!firstChange && host::panel.changes != changesBefore)
+    {
+        firstChange = host::panel.lastChange;
+    }
+}
+
+/**
+ * @brief Prints a failed check and remembers to exit with an error.
+ */
+void check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL: %s\n", what);
+        failed = true;
+    }
+}
+
+/**
+ * @brief Sets up the tank the scenarios measure, a 1 m cylinder of 1 m diameter with a 500 L target.
+ */
+void configureTank()
+{
+    Tank &tank = tanks[0];
+    tank.setting.minHeight = 1000;
+    tank.setting.diameter = 1000;
+    tank.setting.targetCapacity = 500;
+    updateTankGeometry(tank);
+    saveSettings();
+}
+
+/**
+ * @brief Starts the sketch on an erased EEPROM with a trace for the sensor, and sets up the tank.
+ */
+void boot(const host::EchoTrace &trace)
+{
+    host::eraseEeprom();
+    host::setEchoTrace(TRIG_PIN, trace);
+    setup();
+    configureTank();
+}
+
+host::EchoTrace steadyTrace()
+{
+    host::EchoTrace trace;
+    trace.readings.push_back(std::make_pair(0UL, (unsigned int)STEADY_ECHO));
+    return trace;
+}
+
+unsigned long totalMissedDeadlines()
+{
+    unsigned long missed = 0;
+    for (const Task &task : tasks)
+    {
+        missed += task.missedDeadlines;
+    }
+    return missed;
+}
+
+void printLoopTimes(unsigned long long elapsed, uint16_t bound)
+{
+    printf("loop: %lu passes, max %u us, blocked %.2f%% of the time, %lu deadlines missed\n", loopPasses, loopTimeMax,
+           100.0 * loopTimeSum / elapsed, totalMissedDeadlines());
+    check(loopTimeMax <= bound, "a loop pass blocked for too long");
+    check(host::watchdogBites == 0, "the watchdog would have reset the chip");
+}
+
+void printDisplayTraffic()
+{
+    unsigned long frames = max((unsigned long)stats.frames, 1UL);
+    printf("display: %u frames, %lu I2C bytes, %lu a frame, %lu of %lu data bytes redundant, %llu us on the bus\n",
+           stats.frames, host::bus.bytes, host::bus.bytes / frames, host::panel.redundantBytes,
+           host::panel.dataBytes, host::bus.busyUs);
+}
+
+/**
+ * @brief Replays a fill and checks the cutoff opens below the target and closes once the level reaches it.
+ */
+int fill(const char *path)
+{
+    host::EchoTrace trace;
+    if (!trace.load(path))
+    {
+        fprintf(stderr, "cannot read the echo trace %s\n", path);
+        return 2;
+    }
+    boot(trace);
+
+    // When the trace reaches the cutoff echo time for good, as the sketch worked it out from the tank, so a splash
+    // above the target on the way up does not count
+    unsigned long long target = 0;
+    for (unsigned long ms = 0; ms <= trace.duration(); ms++)
+    {
+        unsigned int echo = trace.echoAt(ms);
+        if (echo == NO_ECHO || echo > tanks[0].cutoffEchoTime)
+        {
+            target = 0;
+        }
+        else if (!target)
+        {
+            target = ms * 1000ULL;
+        }
+    }
+
+    unsigned long long opened = 0, closed = 0;
+    unsigned long long end = trace.duration() * 1000ULL;
+    while (host::now() < end)
+    {
+        host::runUntil(host::now() + 1000, collectLoopTime);
+        bool allowed = host::pinLevel(CUTOFF_PIN);
+        if (allowed && !opened)
+        {
+            opened = host::now();
+        }
+        if (!allowed && opened && !closed)
+        {
+            closed = host::now();
+        }
+    }
+
+    printf("fill: target at %.3f s, cutoff opened at %.3f s, closed at %.3f s, %lu mL at the end\n", target / 1e6,
+           opened / 1e6, closed / 1e6, (unsigned long)currentVolume(tanks[0]));
+    printLoopTimes(end, MAX_LOOP_TIME);
+    printDisplayTraffic();
+    printf("eeprom: %lu writes, %llu us waited for\n", host::eeprom.writes, host::eeprom.blockedUs);
+
+    check(target > 0, "the trace never reaches the target");
+    check(opened > 0 && opened < target, "the cutoff never allowed the fill");
+    check(closed >= target && closed <= target + MAX_CUTOFF_DELAY, "the cutoff did not close at the target");
+    check(!host::pinLevel(CUTOFF_PIN), "the cutoff is open above the target");
+    return failed;
+}
+
+/**
+ * @brief Reads a button name of a timeline, returning its pin or 0 for an unknown name.
+ */
+uint8_t buttonPin(const std::string &name)
+{
+    static const struct
+    {
+        const char *name;
+        uint8_t pin;
+    } buttons[] = {{"UP", BUTTON_UP_PIN},
+                   {"DOWN", BUTTON_DOWN_PIN},
+                   {"LEFT", BUTTON_LEFT_PIN},
+                   {"RIGHT", BUTTON_RIGHT_PIN},
+                   {"SELECT", BUTTON_SELECT_PIN}};
+    for (const auto &button : buttons)
+    {
+        if (name == button.name)
+        {
+            return button.pin;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Presses the buttons of a timeline and measures how long each press takes to change the panel.
+ *
+ * The timeline has a "ms BUTTON hold_ms" line per press, '#' starts a comment.
+ */
+int buttons(const char *path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        fprintf(stderr, "cannot read the button timeline %s\n", path);
+        return 2;
+    }
+    std::vector<unsigned long long> presses;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line.substr(0, line.find('#')));
+        unsigned long ms, hold;
+        std::string name;
+        if (!(fields >> ms >> name >> hold))
+        {
+            continue;
+        }
+        uint8_t pin = buttonPin(name);
+        if (!pin)
+        {
+            fprintf(stderr, "unknown button %s\n", name.c_str());
+            return 2;
+        }
+        host::scheduleButton(ms * 1000ULL, pin, true);
+        host::scheduleButton((ms + hold) * 1000ULL, pin, false);
+        presses.push_back(ms * 1000ULL);
+    }
+    if (presses.empty())
+    {
+        fprintf(stderr, "no presses in %s\n", path);
+        return 2;
+    }
+
+    boot(steadyTrace());
+    unsigned long long worst = 0;
+    unsigned int shown = 0;
+    for (size_t i = 0; i < presses.size(); i++)
+    {
+        host::runUntil(presses[i], collectLoopTime);
+        unsigned long long until = i + 1 < presses.size() ? presses[i + 1] : presses[i] + 1000000ULL;
+        changesBefore = host::panel.changes;
+        firstChange = 0;
+        host::runUntil(until, watchPanel);
+        if (!firstChange)
+        {
+            printf("press %u at %.3f s: no change on the panel\n", (unsigned int)i + 1, presses[i] / 1e6);
+            continue;
+        }
+        unsigned long long latency = firstChange - presses[i];
+        printf("press %u at %.3f s: on the panel after %.1f ms\n", (unsigned int)i + 1, presses[i] / 1e6,
+               latency / 1e3);
+        worst = max(worst, latency);
+        shown++;
+    }
+
+    printf("buttons: %u of %u presses shown, worst %.1f ms, the sketch measured %u ms\n", shown,
+           (unsigned int)presses.size(), worst / 1e3, stats.maxInputLatency);
+    printLoopTimes(host::now(), MAX_LOOP_TIME);
+    printDisplayTraffic();
+    check(shown > 0, "no press changed the panel");
+    check(worst <= MAX_INPUT_LATENCY, "a press took longer than MAX_INPUT_LATENCY to show");
+    return failed;
+}
+
+/**
+ * @brief Measures the bus and EEPROM traffic while the level and the screen stay the same.
+ */
+int idle()
+{
+    boot(steadyTrace());
+    host::runUntil(SETTLE_TIME, collectLoopTime);
+
+    unsigned long bytes = host::bus.bytes;
+    unsigned long writes = host::eeprom.writes;
+    unsigned long long start = host::now();
+    host::runUntil(start + 20000000ULL, collectLoopTime);
+    double seconds = (host::now() - start) / 1e6;
+    double rate = (host::bus.bytes - bytes) / seconds;
+
+    printf("idle: %.1f I2C bytes a second, %lu EEPROM writes in %.0f s\n", rate, host::eeprom.writes - writes,
+           seconds);
+    printLoopTimes(host::now(), MAX_LOOP_TIME);
+    check(rate <= MAX_IDLE_BYTES, "the display keeps sending while nothing changes");
+    check(host::eeprom.writes == writes, "the EEPROM is written while nothing changes");
+    return failed;
+}
+
+/**
+ * @brief Saves a profile over and over and measures the EEPROM writes of each save and how they spread.
+ */
+int settings()
+{
+    const unsigned int saves = 200;
+    boot(steadyTrace());
+    host::runUntil(SETTLE_TIME, collectLoopTime);
+
+    unsigned long writes = host::eeprom.writes;
+    uint16_t wear[E2END + 1];
+    memcpy(wear, host::eeprom.wear, sizeof(wear));
+    for (unsigned int i = 0; i < saves; i++)
+    {
+        tanks[0].setting.targetCapacity = 400 + i % 2 * 100;
+        updateTankGeometry(tanks[0]);
+        saveSettings();
+        host::runUntil(host::now() + 2000000ULL, collectLoopTime);
+    }
+
+    uint16_t worst = 0;
+    for (unsigned int address = SETTINGS_LOG_ADDRESS; address < GEOMETRY_TABLE_ADDRESS; address++)
+    {
+        worst = max(worst, (uint16_t)(host::eeprom.wear[address] - wear[address]));
+    }
+    double perSave = (double)(host::eeprom.writes - writes) / saves;
+    printf("settings: %.1f EEPROM writes a save, the most worn byte written %u times in %u saves\n", perSave, worst,
+           saves);
+    printLoopTimes(host::now(), MAX_LOOP_TIME);
+    check(perSave <= 2 * SETTINGS_RECORD_SIZE, "a save writes more than its two records");
+    check(worst <= saves * 2 / SETTINGS_MIN_FREE_SLOTS, "the saves are not spread over the free slots");
+    return failed;
+}
+
+/**
+ * @brief Fails the transfers of a frame and checks the display is set up and drawn again in full afterwards.
+ *
+ * What a full redraw would send is compared with what the panel shows once the bus is back, so a page left out
+ * of the redraw after the recovery shows up as a difference.
+ */
+int recovery()
+{
+    const unsigned int failures = 3; // the frame, and the first reconnect attempts after it
+    boot(steadyTrace());
+    host::runUntil(SETTLE_TIME, collectLoopTime);
+
+    host::bus.failNext = failures;
+    host::bus.failError = BUS_TIMEOUT;
+    host::setButton(BUTTON_SELECT_PIN, true);
+    host::runUntil(host::now() + 150000ULL, collectLoopTime);
+    host::setButton(BUTTON_SELECT_PIN, false);
+    host::runUntil(host::now() + (failures + 2) * DISPLAY_RETRY_PERIOD * 1000ULL, collectLoopTime);
+
+    uint8_t recovered[8][128];
+    memcpy(recovered, host::panel.ram, sizeof(recovered));
+    shownScreen = -1;
+    displayDirty = true;
+    host::runUntil(host::now() + 1000000ULL, collectLoopTime);
+    bool same = memcmp(recovered, host::panel.ram, sizeof(recovered)) == 0;
+
+    printf("recovery: %lu transfers failed, %u bus recoveries, the screen %s a full redraw\n", host::bus.failures,
+           stats.busRecoveries, same ? "matches" : "differs from");
+    printLoopTimes(host::now(), MAX_RECOVERY_TIME);
+    check(host::bus.failNext == 0 && stats.busRecoveries > 0, "the failed transfers were not recovered from");
+    check(host::panel.on, "the display is off after the recovery");
+    check(same, "the screen was not drawn again in full after the recovery");
+    return failed;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::string scenario = argc > 1 ? argv[1] : "";
+    if (scenario == "fill" && argc == 3)
+    {
+        return fill(argv[2]);
+    }
+    if (scenario == "buttons" && argc == 3)
+    {
+        return buttons(argv[2]);
+    }
+    if (scenario == "idle" && argc == 2)
+    {
+        return idle();
+    }
+    if (scenario == "settings" && argc == 2)
+    {
+        return settings();
+    }
+    if (scenario == "recovery" && argc == 2)
+    {
+        return recovery();
+    }
+    fprintf(stderr, "usage: %s fill TRACE | buttons TIMELINE | idle | settings | recovery\n", argv[0]);
+    return 2;
+}
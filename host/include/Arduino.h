@@ -0,0 +1,131 @@
+/**
+ * @file Arduino.h
+ * @brief The parts of the Arduino AVR core mvm.cpp uses, for a host build against the simulated hardware.
+ *
+ * Pins, ports and registers follow the ATmega328 of an Uno or Nano. Time only passes when the simulation
+ * advances it, see hal.h.
+ */
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <type_traits>
+
+#include "Print.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define SDA 18
+#define SCL 19
+#define LED_BUILTIN 13
+#define NUM_DIGITAL_PINS 20
+
+#define E2END 1023
+
+// Flash is ordinary memory on the host
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+#define pgm_read_byte(p) (*reinterpret_cast<const uint8_t *>(p))
+#define pgm_read_word(p) (*reinterpret_cast<const uint16_t *>(p))
+#define pgm_read_dword(p) (*reinterpret_cast<const uint32_t *>(p))
+#define pgm_read_ptr(p) (*(void *const *)(p))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+
+#define PI 3.1415926535897932384626433832795
+#define bit(b) (1UL << (b))
+#define bitRead(value, b) (((value) >> (b)) & 0x01)
+#define bitSet(value, b) ((value) |= bit(b))
+#define bitClear(value, b) ((value) &= ~bit(b))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// By value, as the macros of the core give: with both arguments of one type the conditional is a reference to them
+template <class T, class U>
+auto min(T a, U b) -> typename std::decay<decltype(a < b ? a : b)>::type
+{
+    return a < b ? a : b;
+}
+
+template <class T, class U>
+auto max(T a, U b) -> typename std::decay<decltype(a > b ? a : b)>::type
+{
+    return a > b ? a : b;
+}
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+long map(long value, long fromLow, long fromHigh, long toLow, long toHigh);
+void noInterrupts();
+void interrupts();
+char *ltoa(long value, char *text, int base);
+
+// Registers, each a plain byte the simulation reads and writes
+extern volatile uint8_t PINB, PINC, PIND, PORTB, PORTC, PORTD, DDRB, DDRC, DDRD;
+extern volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+extern volatile uint8_t MCUSR, WDTCSR, EECR, TCCR1A, TCCR1B;
+uint16_t readTimer1();
+#define TCNT1 readTimer1() // Timer1 at clk / 64, 4 us per tick of simulated time
+
+#define _BV(b) (1 << (b))
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define PCIF0 0
+#define PCIF1 1
+#define PCIF2 2
+#define PORF 0
+#define EXTRF 1
+#define BORF 2
+#define WDRF 3
+#define WDP0 0
+#define WDP1 1
+#define WDP2 2
+#define WDE 3
+#define WDCE 4
+#define WDP3 5
+#define WDIE 6
+#define WDIF 7
+#define EEPE 1
+#define CS10 0
+#define CS11 1
+#define CS12 2
+
+#define digitalPinToPort(pin) ((pin) < 8 ? 4 : (pin) < 14 ? 2 : 3) // PD, PB, PC as in the AVR core
+#define digitalPinToBitMask(pin) ((uint8_t)_BV((pin) < 8 ? (pin) : (pin) < 14 ? (pin) - 8 : (pin) - 14))
+#define portOutputRegister(port) ((port) == 2 ? &PORTB : (port) == 3 ? &PORTC : &PORTD)
+
+// What the stack check of the sketch walks, a stand-in for the free RAM between the heap and the stack
+extern uint8_t hostFreeRam[256];
+#define SP (reinterpret_cast<uintptr_t>(hostFreeRam + sizeof(hostFreeRam)))
+
+// Interrupt handlers get C linkage so the simulation can raise them
+#define ISR(vector) extern "C" void vector()
+
+#include "HardwareSerial.h"
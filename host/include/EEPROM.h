@@ -0,0 +1,51 @@
+/**
+ * @file EEPROM.h
+ * @brief The EEPROM library of the AVR core, on the simulated EEPROM that counts its write cycles.
+ *
+ * A write starts a 3.4 ms write cycle like the chip's, and a read or write while one is in progress waits for it.
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#include "hal.h"
+
+bool eeprom_is_ready();
+
+struct EEPROMClass
+{
+    uint8_t read(int address);
+    void write(int address, uint8_t value);
+    void update(int address, uint8_t value)
+    {
+        if (read(address) != value)
+        {
+            write(address, value);
+        }
+    }
+    uint16_t length() { return E2END + 1; }
+
+    template <typename T>
+    T &get(int address, T &value)
+    {
+        uint8_t *bytes = reinterpret_cast<uint8_t *>(&value);
+        for (size_t i = 0; i < sizeof(T); i++)
+        {
+            bytes[i] = read(address + i);
+        }
+        return value;
+    }
+
+    template <typename T>
+    const T &put(int address, const T &value)
+    {
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+        for (size_t i = 0; i < sizeof(T); i++)
+        {
+            update(address + i, bytes[i]);
+        }
+        return value;
+    }
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,45 @@
+/**
+ * @file HardwareSerial.h
+ * @brief A UART whose transmit buffer drains at the baud rate in simulated time, and whose input is injected.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+
+#include "Print.h"
+
+#define SERIAL_TX_BUFFER_SIZE 64
+#define SERIAL_RX_BUFFER_SIZE 64
+
+class HardwareSerial : public Stream
+{
+public:
+    void begin(unsigned long baud) { this->baud = baud; }
+    void end() { baud = 0; }
+    int available() override { return static_cast<int>(input.size()); }
+    int read() override;
+    int peek() override { return input.empty() ? -1 : input.front(); }
+    int availableForWrite() override;
+    void flush();
+    size_t write(uint8_t value) override;
+    using Print::write;
+    operator bool() { return true; }
+
+    // Simulation side
+    void inject(const uint8_t *data, size_t size); // bytes arriving from the host, dropped beyond the RX buffer
+    void drain(unsigned long us);                  // moves the transmit buffer on by us of line time
+    std::string sent;                              // every byte that has left the transmit buffer
+    unsigned long droppedInput = 0;
+
+private:
+    unsigned long baud = 0;
+    std::deque<uint8_t> input;
+    std::deque<uint8_t> output;
+    unsigned long lineTime = 0; // us into the byte being shifted out
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
@@ -0,0 +1,38 @@
+/**
+ * @file NewPing.h
+ * @brief The timer-driven pings of NewPing, answered from the echo trace set for the sensor's trigger pin.
+ *
+ * ping_timer() looks up the echo time for the time of the ping and calls the echo function once it is due,
+ * with check_timer() true for that call. A ping with no echo, or one beyond the distance listened for,
+ * never calls it, as NewPing stops its timer without an echo.
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#define MAX_SENSOR_DISTANCE 500 // cm
+#define US_ROUNDTRIP_CM 57
+#define NO_ECHO 0
+#define PING_MEDIAN_DELAY 29000
+#define TRIGGER_WIDTH 12 // us the trigger pin is held high, after which the echo is timed
+
+class NewPing
+{
+public:
+    NewPing(uint8_t triggerPin, uint8_t echoPin, unsigned int maxDistance = MAX_SENSOR_DISTANCE)
+        : triggerPin(triggerPin), echoPin(echoPin), maxDistance(maxDistance)
+    {
+    }
+
+    void ping_timer(void (*echoFunction)(), unsigned int maxDistance = 0);
+    bool check_timer();
+    static void timer_stop();
+
+    unsigned long ping_result = 0; // us of the echo, once check_timer() is true
+
+    const uint8_t triggerPin;
+    const uint8_t echoPin;
+
+private:
+    unsigned int maxDistance; // cm
+};
@@ -0,0 +1,47 @@
+/**
+ * @file Wire.h
+ * @brief The Wire master of the AVR core, on a simulated bus with the SSD1306 at its address.
+ *
+ * Transactions are limited to the 32-byte buffer of the AVR library, and endTransmission() blocks for the time
+ * they take on the wire at the clock set.
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#define BUFFER_LENGTH 32
+#define WIRE_HAS_TIMEOUT 1
+
+class TwoWire : public Stream
+{
+public:
+    void begin() { enabled = true; }
+    void end() { enabled = false; }
+    void setClock(uint32_t clock) { this->clock = clock; }
+    void setWireTimeout(uint32_t timeout = 25000, bool resetWithTimeout = false);
+    bool getWireTimeoutFlag() { return timeoutFlag; }
+    void clearWireTimeoutFlag() { timeoutFlag = false; }
+
+    void beginTransmission(uint8_t address);
+    uint8_t endTransmission(bool sendStop = true);
+    uint8_t requestFrom(uint8_t address, uint8_t quantity);
+    size_t write(uint8_t value) override;
+    size_t write(const uint8_t *data, size_t size) override;
+    using Print::write;
+    int available() override { return received - readIndex; }
+    int read() override { return readIndex < received ? rxBuffer[readIndex++] : -1; }
+    int peek() override { return readIndex < received ? rxBuffer[readIndex] : -1; }
+
+private:
+    bool enabled = false;
+    bool timeoutFlag = false;
+    uint32_t clock = 100000;
+    uint8_t address = 0;
+    uint8_t txBuffer[BUFFER_LENGTH];
+    uint8_t txLength = 0;
+    uint8_t rxBuffer[BUFFER_LENGTH];
+    uint8_t received = 0;
+    uint8_t readIndex = 0;
+};
+
+extern TwoWire Wire;
@@ -0,0 +1,15 @@
+/**
+ * @file sleep.h
+ * @brief The sleep modes of avr-libc. sleep_cpu() lets simulated time pass until an interrupt wakes the chip.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_PWR_DOWN 2
+
+void set_sleep_mode(uint8_t mode);
+void sleep_enable();
+void sleep_disable();
+void sleep_cpu();
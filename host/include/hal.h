@@ -0,0 +1,106 @@
+/**
+ * @file hal.h
+ * @brief The simulated board behind the host shims, for benchmarks to drive the sketch and measure it.
+ *
+ * Nothing runs on its own: time only passes through advance(), or while the sketch blocks on the bus, the EEPROM,
+ * a full UART or a delay(), each charged what it takes on the real chip. The interrupts that fall due on the way
+ * are raised in time order, unless noInterrupts() holds them back. The CPU itself costs no time, so the loop times
+ * the sketch measures are the time it spends waiting on the hardware.
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace host
+{
+
+/**
+ * @brief Recorded echo times of a sensor, replayed by the simulated NewPing.
+ *
+ * The file has a "ms,echo_us" line per reading, '#' starts a comment. Between two echoes the time is interpolated,
+ * an echo time of 0 is a ping that got no echo and holds until the next reading.
+ */
+struct EchoTrace
+{
+    std::vector<std::pair<unsigned long, unsigned int>> readings; // ms, us
+
+    bool load(const std::string &path);
+    unsigned int echoAt(unsigned long ms) const;
+    unsigned long duration() const { return readings.empty() ? 0 : readings.back().first; }
+};
+
+/**
+ * @brief What the SSD1306 on the bus holds and shows, decoded from the I2C traffic sent to it.
+ *
+ * Every data byte is compared with the GDDRAM byte it overwrites, so a byte sent to a page that did not change
+ * counts as redundant.
+ */
+struct Panel
+{
+    uint8_t address = 0x3D;  // I2C address it answers on
+    uint8_t ram[8][128];     // GDDRAM, a byte per page and column, bit 0 the top row of the page
+    bool on = false;
+    bool inverted = false;
+    uint8_t contrast = 0x7F;
+    uint8_t columnStart = 0, columnEnd = 127, pageStart = 0, pageEnd = 7;
+    bool pageAddressing = false;         // page addressing mode, else horizontal
+    uint8_t column = 0, page = 0;        // where the next data byte goes
+    unsigned long commandBytes = 0;
+    unsigned long dataBytes = 0;
+    unsigned long redundantBytes = 0;    // data bytes equal to what was already in GDDRAM
+    unsigned long long lastChange = 0;   // us of the last change of what the panel shows
+    unsigned long changes = 0;           // writes that changed what the panel shows
+
+    bool pixel(uint8_t x, uint8_t y) const { return ram[y / 8][x] & (1 << (y % 8)); }
+};
+
+struct Bus
+{
+    unsigned long transactions = 0;
+    unsigned long bytes = 0;        // address and payload bytes, as clocked onto the wire
+    unsigned long long busyUs = 0;  // time the sketch spent blocked in endTransmission()
+    unsigned long failures = 0;
+    unsigned int failNext = 0;      // transactions still to fail with failError, for fault injection
+    uint8_t failError = 2;          // endTransmission() result of a failed transaction, 2 is a NACK on the address
+};
+
+struct Eeprom
+{
+    uint8_t memory[E2END + 1];
+    unsigned long reads = 0;
+    unsigned long writes = 0;                // write cycles started, the wear the sketch causes
+    uint16_t wear[E2END + 1] = {0};          // write cycles per cell
+    unsigned long long busyUntil = 0;        // us when the write cycle in progress ends
+    unsigned long long blockedUs = 0;        // time the sketch spent waiting for a write cycle to end
+};
+
+extern Panel panel;
+extern Bus bus;
+extern Eeprom eeprom;
+extern unsigned long watchdogBites; // times a task held the loop past the watchdog timeout
+
+unsigned long long now(); // us of simulated time since power-up
+void advance(unsigned long long us);
+void advanceTo(unsigned long long us);
+
+/**
+ * @brief Runs loop() until a time, as the chip would, sleeping where the sketch sleeps.
+ *
+ * @param us The simulated time to stop at.
+ * @param step Called after each loop() pass, e.g. to collect its loop time, may be NULL.
+ */
+void runUntil(unsigned long long us, void (*step)());
+
+void setButton(uint8_t pin, bool pressed);
+void scheduleButton(unsigned long long us, uint8_t pin, bool pressed);
+void setEchoTrace(uint8_t trigPin, const EchoTrace &trace);
+void setAnalog(uint8_t pin, int value);
+bool pinLevel(uint8_t pin); // the level the sketch drives a pin to, from its port register
+
+void eraseEeprom(); // every byte 0xFF, as a new chip
+
+} // namespace host
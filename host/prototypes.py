@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+"""Turns the sketch into a C++ translation unit, as the Arduino builder does before compiling it.
+
+The builder includes Arduino.h and declares every function defined in the sketch ahead of its first definition,
+so a function can be called above the place it is defined. This does the same for the style of mvm.cpp:
+a definition is a line at file scope ending in ')' whose next line opens the body with '{'.
+
+usage: prototypes.py SKETCH OUTPUT [--disable MACRO]...
+
+--disable comments out a '#define MACRO' line of the sketch, to build a variant such as the framebuffer renderer.
+"""
+import argparse
+import re
+
+NOT_FUNCTIONS = re.compile(r'^(struct|class|enum|union|typedef|template|namespace|ISR|if|for|while|switch|return)\b')
+
+
+def prototypes(lines):
+    """Returns the index of the first function definition and the prototypes of all of them."""
+    first = None
+    found = []
+    depth = 0
+    for i, line in enumerate(lines):
+        if depth == 0 and re.match(r'^[A-Za-z_]', line) and line.rstrip().endswith(')') and '(' in line \
+                and '::' not in line and not NOT_FUNCTIONS.match(line):
+            body = i + 1
+            while body < len(lines) and lines[body].strip() == '':
+                body += 1
+            if body < len(lines) and lines[body].strip() == '{':
+                if first is None:
+                    first = i
+                found.append(line.rstrip() + ';')
+        depth += line.count('{') - line.count('}')
+    return first, found
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('sketch')
+    parser.add_argument('output')
+    parser.add_argument('--disable', action='append', default=[], metavar='MACRO')
+    args = parser.parse_args()
+
+    with open(args.sketch, newline='') as f:
+        lines = f.read().replace('\r\n', '\n').split('\n')
+    for macro in args.disable:
+        pattern = re.compile(r'^#define %s\b' % re.escape(macro))
+        hits = [i for i, line in enumerate(lines) if pattern.match(line)]
+        if not hits:
+            parser.error('%s is not defined in %s' % (macro, args.sketch))
+        for i in hits:
+            lines[i] = '// ' + lines[i]
+
+    first, found = prototypes(lines)
+    if first is None:
+        parser.error('no function definitions in %s' % args.sketch)
+
+    sketch = args.sketch.replace('\\', '/')
+    out = ['#include <Arduino.h>', '#line 1 "%s"' % sketch]
+    out += lines[:first]
+    out += found
+    out += ['#line %d "%s"' % (first + 1, sketch)]
+    out += lines[first:]
+    with open(args.output, 'w') as f:
+        f.write('\n'.join(out) + '\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,612 @@
+/**
+ * @file display.cpp
+ * @brief The simulated I2C bus, the SSD1306 on it, and the Adafruit_GFX and Adafruit_SSD1306 calls that drive it.
+ */
+#include <Adafruit_GFX.h>
+#include <Adafruit_SSD1306.h>
+#include <Wire.h>
+
+#include "hal.h"
+
+#include <utility>
+
+#define WIRE_MAX min(256, BUFFER_LENGTH) // bytes Adafruit_SSD1306 puts in a transaction
+#define TIMEOUT_ERROR 5                  // what endTransmission() returns after a bus timeout
+
+TwoWire Wire;
+
+namespace
+{
+
+/**
+ * @brief Decodes what is sent to the panel, keeping a command that waits for its arguments across transactions.
+ *
+ * Adafruit_SSD1306 sends the argument of a command in a transaction of its own, so the decoder has to carry on
+ * from where the last transaction left off.
+ */
+struct PanelDecoder
+{
+    uint8_t command = 0;
+    uint8_t arguments[6];
+    uint8_t expected = 0; // arguments the command takes
+    uint8_t received = 0;
+
+    void start(uint8_t value);
+    void apply();
+    void data(uint8_t value);
+};
+
+PanelDecoder decoder;
+
+/**
+ * @brief Returns how many argument bytes follow a command.
+ */
+uint8_t argumentCount(uint8_t command)
+{
+    switch (command)
+    {
+    case 0x20: // memory mode
+    case 0x81: // contrast
+    case 0x8D: // charge pump
+    case 0xA8: // multiplex
+    case 0xD3: // display offset
+    case 0xD5: // clock divide
+    case 0xD9: // precharge
+    case 0xDA: // COM pins
+    case 0xDB: // VCOM detect
+        return 1;
+    case 0x21: // column address
+    case 0x22: // page address
+    case 0xA3: // vertical scroll area
+        return 2;
+    case 0x29: // vertical and horizontal scroll
+    case 0x2A:
+        return 5;
+    case 0x26: // horizontal scroll
+    case 0x27:
+        return 6;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Notes a change of what the panel shows.
+ */
+void changed()
+{
+    host::panel.lastChange = host::now();
+    host::panel.changes++;
+}
+
+void PanelDecoder::start(uint8_t value)
+{
+    if (received < expected)
+    {
+        arguments[received++] = value;
+    }
+    else
+    {
+        command = value;
+        expected = argumentCount(value);
+        received = 0;
+    }
+    if (received == expected)
+    {
+        apply();
+    }
+}
+
+void PanelDecoder::apply()
+{
+    host::Panel &panel = host::panel;
+    switch (command)
+    {
+    case 0x20:
+        panel.pageAddressing = (arguments[0] & 0x03) == 0x02;
+        break;
+    case 0x21:
+        panel.columnStart = panel.column = arguments[0] & 0x7F;
+        panel.columnEnd = arguments[1] & 0x7F;
+        break;
+    case 0x22:
+        panel.pageStart = panel.page = arguments[0] & 0x07;
+        panel.pageEnd = arguments[1] & 0x07;
+        break;
+    case 0x81:
+        if (panel.contrast != arguments[0])
+        {
+            panel.contrast = arguments[0];
+            changed();
+        }
+        break;
+    case 0xA6:
+    case 0xA7:
+        if (panel.inverted != (command == 0xA7))
+        {
+            panel.inverted = command == 0xA7;
+            changed();
+        }
+        break;
+    case 0xAE:
+    case 0xAF:
+        if (panel.on != (command == 0xAF))
+        {
+            panel.on = command == 0xAF;
+            changed();
+        }
+        break;
+    default:
+        if (command < 0x10)
+        {
+            panel.column = (panel.column & 0xF0) | command;
+        }
+        else if (command < 0x20)
+        {
+            panel.column = ((command & 0x07) << 4) | (panel.column & 0x0F);
+        }
+        else if (command >= 0xB0 && command <= 0xB7)
+        {
+            panel.page = command & 0x07;
+        }
+        break;
+    }
+}
+
+void PanelDecoder::data(uint8_t value)
+{
+    host::Panel &panel = host::panel;
+    uint8_t &cell = panel.ram[panel.page][panel.column];
+    if (cell == value)
+    {
+        panel.redundantBytes++;
+    }
+    else
+    {
+        cell = value;
+        if (panel.on)
+        {
+            changed();
+        }
+    }
+
+    if (panel.pageAddressing)
+    {
+        panel.column = (panel.column + 1) & 0x7F;
+    }
+    else if (panel.column < panel.columnEnd)
+    {
+        panel.column++;
+    }
+    else
+    {
+        panel.column = panel.columnStart;
+        panel.page = panel.page < panel.pageEnd ? panel.page + 1 : panel.pageStart;
+    }
+}
+
+/**
+ * @brief Hands the bytes of a transaction to the panel, after the control byte that says what each one is.
+ *
+ * A control byte with Co set covers the one byte after it, without it the rest of the transaction.
+ */
+void receive(const uint8_t *bytes, uint8_t length)
+{
+    uint8_t i = 0;
+    while (i < length)
+    {
+        uint8_t control = bytes[i++];
+        bool isData = control & 0x40;
+        uint8_t end = control & 0x80 ? min(i + 1, (int)length) : length;
+        for (; i < end; i++)
+        {
+            if (isData)
+            {
+                decoder.data(bytes[i]);
+                host::panel.dataBytes++;
+            }
+            else
+            {
+                decoder.start(bytes[i]);
+                host::panel.commandBytes++;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Blocks for the time some bytes take on the bus, each eight bits and an acknowledge, plus start and stop.
+ */
+void clockOut(unsigned long bytes, uint32_t clock)
+{
+    unsigned long long us = ((unsigned long long)bytes * 9 + 2) * 1000000ULL / clock;
+    host::bus.transactions++;
+    host::bus.bytes += bytes;
+    host::bus.busyUs += us;
+    host::advance(us);
+}
+
+} // namespace
+
+void TwoWire::setWireTimeout(uint32_t timeout, bool resetWithTimeout)
+{
+    (void)timeout;
+    (void)resetWithTimeout;
+    timeoutFlag = false;
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+    this->address = address;
+    txLength = 0;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop)
+{
+    (void)sendStop;
+    if (!enabled)
+    {
+        return 4;
+    }
+    if (host::bus.failNext > 0)
+    {
+        host::bus.failNext--;
+        host::bus.failures++;
+        clockOut(1, clock);
+        if (host::bus.failError == TIMEOUT_ERROR)
+        {
+            timeoutFlag = true;
+        }
+        return host::bus.failError;
+    }
+    if (address != host::panel.address)
+    {
+        // Nothing acknowledges the address
+        clockOut(1, clock);
+        return 2;
+    }
+    clockOut(1 + txLength, clock);
+    receive(txBuffer, txLength);
+    txLength = 0;
+    return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity)
+{
+    (void)address;
+    (void)quantity;
+    // The panel cannot be read over I2C and nothing else is on the bus
+    clockOut(1, clock);
+    received = readIndex = 0;
+    return 0;
+}
+
+size_t TwoWire::write(uint8_t value)
+{
+    if (txLength >= BUFFER_LENGTH)
+    {
+        return 0;
+    }
+    txBuffer[txLength++] = value;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t size)
+{
+    size_t written = 0;
+    while (written < size && write(data[written]))
+    {
+        written++;
+    }
+    return written;
+}
+
+/**
+ * @brief Returns column i of the stand-in glyph of a character, nothing for a space.
+ */
+static uint8_t glyphColumn(unsigned char c, uint8_t i)
+{
+    if (c == ' ')
+    {
+        return 0;
+    }
+    return (uint8_t)(((c * 0x9D) ^ (i * 0x35)) & 0x7F) | 0x01;
+}
+
+void Adafruit_GFX::drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color)
+{
+    for (int16_t i = 0; i < h; i++)
+    {
+        drawPixel(x, y + i, color);
+    }
+}
+
+void Adafruit_GFX::drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color)
+{
+    for (int16_t i = 0; i < w; i++)
+    {
+        drawPixel(x + i, y, color);
+    }
+}
+
+void Adafruit_GFX::fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+{
+    for (int16_t i = x; i < x + w; i++)
+    {
+        drawFastVLine(i, y, h, color);
+    }
+}
+
+void Adafruit_GFX::drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color)
+{
+    if (x0 == x1)
+    {
+        drawFastVLine(x0, min(y0, y1), abs(y1 - y0) + 1, color);
+        return;
+    }
+    if (y0 == y1)
+    {
+        drawFastHLine(min(x0, x1), y0, abs(x1 - x0) + 1, color);
+        return;
+    }
+
+    // Bresenham, as the library draws it
+    bool steep = abs(y1 - y0) > abs(x1 - x0);
+    if (steep)
+    {
+        std::swap(x0, y0);
+        std::swap(x1, y1);
+    }
+    if (x0 > x1)
+    {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+    }
+    int16_t dx = x1 - x0;
+    int16_t dy = abs(y1 - y0);
+    int16_t err = dx / 2;
+    int16_t ystep = y0 < y1 ? 1 : -1;
+    for (; x0 <= x1; x0++)
+    {
+        if (steep)
+        {
+            drawPixel(y0, x0, color);
+        }
+        else
+        {
+            drawPixel(x0, y0, color);
+        }
+        err -= dy;
+        if (err < 0)
+        {
+            y0 += ystep;
+            err += dx;
+        }
+    }
+}
+
+void Adafruit_GFX::drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+{
+    drawFastHLine(x, y, w, color);
+    drawFastHLine(x, y + h - 1, w, color);
+    drawFastVLine(x, y, h, color);
+    drawFastVLine(x + w - 1, y, h, color);
+}
+
+void Adafruit_GFX::drawChar(int16_t x, int16_t y, unsigned char c, uint16_t color, uint16_t bg, uint8_t size)
+{
+    if (x >= _width || y >= _height || x + 6 * size - 1 < 0 || y + 8 * size - 1 < 0)
+    {
+        return;
+    }
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        uint8_t line = glyphColumn(c, i);
+        for (uint8_t j = 0; j < 8; j++, line >>= 1)
+        {
+            if (line & 1)
+            {
+                fillRect(x + i * size, y + j * size, size, size, color);
+            }
+            else if (bg != color)
+            {
+                fillRect(x + i * size, y + j * size, size, size, bg);
+            }
+        }
+    }
+    if (bg != color)
+    {
+        // The gap after the character
+        fillRect(x + 5 * size, y, size, 8 * size, bg);
+    }
+}
+
+size_t Adafruit_GFX::write(uint8_t c)
+{
+    if (c == '\n')
+    {
+        cursor_x = 0;
+        cursor_y += textsize * 8;
+    }
+    else if (c != '\r')
+    {
+        if (wrap && cursor_x + textsize * 6 > _width)
+        {
+            cursor_x = 0;
+            cursor_y += textsize * 8;
+        }
+        drawChar(cursor_x, cursor_y, c, textcolor, textbgcolor, textsize);
+        cursor_x += textsize * 6;
+    }
+    return 1;
+}
+
+Adafruit_SSD1306::Adafruit_SSD1306(uint8_t w, uint8_t h, TwoWire *twi, int8_t rst_pin, uint32_t clkDuring,
+                                   uint32_t clkAfter)
+    : Adafruit_GFX(w, h), wire(twi), rstPin(rst_pin), wireClk(clkDuring), restoreClk(clkAfter)
+{
+}
+
+Adafruit_SSD1306::~Adafruit_SSD1306()
+{
+    free(buffer);
+}
+
+/**
+ * Sends the set-up of the library for a 128x64 panel, command by command as it does. Like the library it only
+ * fails when the framebuffer cannot be allocated, a panel that does not answer goes unnoticed.
+ */
+bool Adafruit_SSD1306::begin(uint8_t switchvcc, uint8_t i2caddr, bool reset, bool periphBegin)
+{
+    if (!buffer && !(buffer = static_cast<uint8_t *>(malloc(WIDTH * ((HEIGHT + 7) / 8)))))
+    {
+        return false;
+    }
+    clearDisplay();
+    vccstate = switchvcc;
+    this->i2caddr = i2caddr ? i2caddr : (HEIGHT == 32 ? 0x3C : 0x3D);
+    if (periphBegin)
+    {
+        wire->begin();
+    }
+    if (reset && rstPin >= 0)
+    {
+        pinMode(rstPin, OUTPUT);
+        digitalWrite(rstPin, HIGH);
+        delay(1);
+        digitalWrite(rstPin, LOW);
+        delay(10);
+        digitalWrite(rstPin, HIGH);
+    }
+
+    bool external = vccstate == SSD1306_EXTERNALVCC;
+    contrast = external ? 0x9F : 0xCF;
+    wire->setClock(wireClk);
+    static const uint8_t init1[] = {SSD1306_DISPLAYOFF, SSD1306_SETDISPLAYCLOCKDIV, 0x80, SSD1306_SETMULTIPLEX};
+    commandList(init1, sizeof(init1));
+    ssd1306_command1(HEIGHT - 1);
+    static const uint8_t init2[] = {SSD1306_SETDISPLAYOFFSET, 0x0, SSD1306_SETSTARTLINE | 0x0, SSD1306_CHARGEPUMP};
+    commandList(init2, sizeof(init2));
+    ssd1306_command1(external ? 0x10 : 0x14);
+    static const uint8_t init3[] = {SSD1306_MEMORYMODE, 0x00, SSD1306_SEGREMAP | 0x1, SSD1306_COMSCANDEC};
+    commandList(init3, sizeof(init3));
+    ssd1306_command1(SSD1306_SETCOMPINS);
+    ssd1306_command1(0x12);
+    ssd1306_command1(SSD1306_SETCONTRAST);
+    ssd1306_command1(contrast);
+    ssd1306_command1(SSD1306_SETPRECHARGE);
+    ssd1306_command1(external ? 0x22 : 0xF1);
+    static const uint8_t init5[] = {SSD1306_SETVCOMDETECT,     0x40, SSD1306_DISPLAYALLON_RESUME, SSD1306_NORMALDISPLAY,
+                                    SSD1306_DEACTIVATE_SCROLL, SSD1306_DISPLAYON};
+    commandList(init5, sizeof(init5));
+    wire->setClock(restoreClk);
+    return true;
+}
+
+void Adafruit_SSD1306::display()
+{
+    wire->setClock(wireClk);
+    static const uint8_t dlist1[] = {SSD1306_PAGEADDR, 0, 0xFF, SSD1306_COLUMNADDR, 0};
+    commandList(dlist1, sizeof(dlist1));
+    ssd1306_command1(WIDTH - 1);
+
+    uint16_t count = WIDTH * ((HEIGHT + 7) / 8);
+    const uint8_t *ptr = buffer;
+    wire->beginTransmission(i2caddr);
+    wire->write((uint8_t)0x40);
+    uint16_t bytesOut = 1;
+    while (count--)
+    {
+        if (bytesOut >= WIRE_MAX)
+        {
+            wire->endTransmission();
+            wire->beginTransmission(i2caddr);
+            wire->write((uint8_t)0x40);
+            bytesOut = 1;
+        }
+        wire->write(*ptr++);
+        bytesOut++;
+    }
+    wire->endTransmission();
+    wire->setClock(restoreClk);
+}
+
+void Adafruit_SSD1306::clearDisplay()
+{
+    memset(buffer, 0, WIDTH * ((HEIGHT + 7) / 8));
+}
+
+void Adafruit_SSD1306::invertDisplay(bool i)
+{
+    wire->setClock(wireClk);
+    ssd1306_command1(i ? SSD1306_INVERTDISPLAY : SSD1306_NORMALDISPLAY);
+    wire->setClock(restoreClk);
+}
+
+void Adafruit_SSD1306::dim(bool dim)
+{
+    wire->setClock(wireClk);
+    ssd1306_command1(SSD1306_SETCONTRAST);
+    ssd1306_command1(dim ? 0 : contrast);
+    wire->setClock(restoreClk);
+}
+
+void Adafruit_SSD1306::drawPixel(int16_t x, int16_t y, uint16_t color)
+{
+    if (x < 0 || x >= width() || y < 0 || y >= height())
+    {
+        return;
+    }
+    uint8_t &cell = buffer[x + (y / 8) * WIDTH];
+    uint8_t mask = 1 << (y & 7);
+    switch (color)
+    {
+    case SSD1306_WHITE:
+        cell |= mask;
+        break;
+    case SSD1306_BLACK:
+        cell &= ~mask;
+        break;
+    case SSD1306_INVERSE:
+        cell ^= mask;
+        break;
+    }
+}
+
+void Adafruit_SSD1306::ssd1306_command(uint8_t c)
+{
+    wire->setClock(wireClk);
+    ssd1306_command1(c);
+    wire->setClock(restoreClk);
+}
+
+void Adafruit_SSD1306::ssd1306_command1(uint8_t c)
+{
+    wire->beginTransmission(i2caddr);
+    wire->write((uint8_t)0x00);
+    wire->write(c);
+    wire->endTransmission();
+}
+
+/**
+ * Commands that do not fit one transaction go on in the next, each starting with the control byte again.
+ */
+void Adafruit_SSD1306::commandList(const uint8_t *c, uint8_t n)
+{
+    wire->beginTransmission(i2caddr);
+    wire->write((uint8_t)0x00);
+    uint16_t bytesOut = 1;
+    while (n--)
+    {
+        if (bytesOut >= WIRE_MAX)
+        {
+            wire->endTransmission();
+            wire->beginTransmission(i2caddr);
+            wire->write((uint8_t)0x00);
+            bytesOut = 1;
+        }
+        wire->write(*c++);
+        bytesOut++;
+    }
+    wire->endTransmission();
+}
@@ -0,0 +1,622 @@
+/**
+ * @file hal.cpp
+ * @brief The simulated clock and the interrupts, pins, sleep modes, watchdog, UART, EEPROM and sensors behind it.
+ */
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <NewPing.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+
+#include "hal.h"
+
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#define EEPROM_WRITE_TIME 3400 // us of an EEPROM write cycle
+#define NEVER (~0ULL)
+
+void loop();
+extern "C" void PCINT2_vect();
+extern "C" void WDT_vect();
+
+volatile uint8_t PINB = 0xFF, PINC = 0xFF, PIND = 0xFF, PORTB, PORTC, PORTD, DDRB, DDRC, DDRD;
+volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+volatile uint8_t MCUSR = _BV(PORF), WDTCSR, EECR, TCCR1A, TCCR1B;
+volatile unsigned long timer0_millis = 0; // what millis() returns, the sketch moves it on over a power-down
+uint8_t hostFreeRam[256];
+uint8_t __heap_start;
+uint8_t *__brkval = hostFreeRam;
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+EEPROMClass EEPROM;
+
+namespace host
+{
+
+Panel panel;
+Bus bus;
+Eeprom eeprom;
+unsigned long watchdogBites = 0;
+
+namespace
+{
+
+unsigned long long simTime = 0;       // us since power-up
+unsigned long long timer0Time = 0;    // us Timer0 has counted, it stops in power-down
+bool interruptsEnabled = true;
+bool inInterrupt = false;
+bool woken = false;                   // an interrupt ran since the chip went to sleep
+bool poweredDown = false;
+uint8_t sleepMode = SLEEP_MODE_IDLE;
+bool sleepEnabled = false;
+bool slept = false;                   // the last loop() pass went to sleep
+bool pinChangePending = false;        // a button edge whose interrupt waits for interrupts()
+unsigned long long watchdogResetTime = 0;
+int analogValues[NUM_DIGITAL_PINS];
+
+std::multimap<unsigned long long, std::pair<uint8_t, bool>> buttonEdges; // us, pin and pressed
+std::map<uint8_t, EchoTrace> echoTraces;                                  // by trigger pin
+NewPing *pinging = NULL;                 // sensor of the ping in flight
+void (*echoFunction)() = NULL;
+unsigned long long echoTime = NEVER;     // us the echo of that ping comes back
+bool echoArrived = false;
+
+/**
+ * @brief Returns when the watchdog times out, NEVER while it is off.
+ */
+unsigned long long watchdogDeadline()
+{
+    if (!(WDTCSR & (_BV(WDE) | _BV(WDIE))))
+    {
+        return NEVER;
+    }
+    uint8_t prescaler = (WDTCSR & 0x07) | (WDTCSR & _BV(WDP3) ? 8 : 0);
+    return watchdogResetTime + (16000ULL << prescaler);
+}
+
+/**
+ * @brief Sets a button pin, and flags the pin change interrupt if it is enabled for it.
+ */
+void applyButton(uint8_t pin, bool pressed)
+{
+    uint8_t mask = _BV(pin);
+    uint8_t levels = pressed ? PIND & ~mask : PIND | mask;
+    if (levels == PIND)
+    {
+        return;
+    }
+    PIND = levels;
+    if ((PCICR & _BV(PCIE2)) && (PCMSK2 & mask))
+    {
+        pinChangePending = true;
+    }
+}
+
+/**
+ * @brief Runs an interrupt handler as the chip would, with interrupts off and an awake CPU.
+ */
+void raise(void (*handler)())
+{
+    inInterrupt = true;
+    handler();
+    inInterrupt = false;
+    woken = true;
+}
+
+/**
+ * @brief Raises whatever interrupts are due, unless interrupts are off or one is already running.
+ */
+void dispatch()
+{
+    if (!interruptsEnabled || inInterrupt)
+    {
+        return;
+    }
+
+    while (!buttonEdges.empty() && buttonEdges.begin()->first <= simTime)
+    {
+        std::pair<uint8_t, bool> edge = buttonEdges.begin()->second;
+        buttonEdges.erase(buttonEdges.begin());
+        applyButton(edge.first, edge.second);
+    }
+    if (pinChangePending)
+    {
+        pinChangePending = false;
+        raise(PCINT2_vect);
+    }
+
+    if (echoTime <= simTime)
+    {
+        echoTime = NEVER;
+        echoArrived = true;
+        raise(echoFunction);
+        echoArrived = false;
+        pinging = NULL;
+    }
+
+    if (watchdogDeadline() <= simTime)
+    {
+        watchdogResetTime = simTime;
+        if (WDTCSR & _BV(WDE))
+        {
+            // A task held the loop for the whole timeout, the chip would reset here
+            watchdogBites++;
+        }
+        else
+        {
+            raise(WDT_vect);
+        }
+    }
+}
+
+/**
+ * @brief Returns the next time an interrupt may fall due after now.
+ */
+unsigned long long nextEvent()
+{
+    unsigned long long next = NEVER;
+    if (!buttonEdges.empty())
+    {
+        next = min(next, buttonEdges.begin()->first);
+    }
+    if (echoTime != NEVER)
+    {
+        next = min(next, echoTime);
+    }
+    next = min(next, watchdogDeadline());
+    if (!poweredDown)
+    {
+        // The Timer0 tick that keeps millis() going, and wakes the chip from idle
+        next = min(next, simTime + 1000 - timer0Time % 1000);
+    }
+    return max(next, simTime + 1);
+}
+
+} // namespace
+
+unsigned long long now()
+{
+    return simTime;
+}
+
+void advanceTo(unsigned long long us)
+{
+    dispatch();
+    while (simTime < us)
+    {
+        unsigned long long next = min(nextEvent(), us);
+        unsigned long long elapsed = next - simTime;
+        simTime = next;
+        if (!poweredDown)
+        {
+            unsigned long long before = timer0Time;
+            timer0Time += elapsed;
+            timer0_millis += timer0Time / 1000 - before / 1000;
+        }
+        Serial.drain(elapsed);
+        Serial1.drain(elapsed);
+        dispatch();
+    }
+}
+
+void advance(unsigned long long us)
+{
+    advanceTo(simTime + us);
+}
+
+void runUntil(unsigned long long us, void (*step)())
+{
+    while (simTime < us)
+    {
+        slept = false;
+        loop();
+        if (step)
+        {
+            step();
+        }
+        if (!slept)
+        {
+            // The CPU costs no time, so a pass that does not sleep moves the clock on by a microsecond
+            advance(1);
+        }
+    }
+}
+
+void setButton(uint8_t pin, bool pressed)
+{
+    applyButton(pin, pressed);
+    dispatch();
+}
+
+void scheduleButton(unsigned long long us, uint8_t pin, bool pressed)
+{
+    buttonEdges.insert(std::make_pair(us, std::make_pair(pin, pressed)));
+}
+
+void setEchoTrace(uint8_t trigPin, const EchoTrace &trace)
+{
+    echoTraces[trigPin] = trace;
+}
+
+void setAnalog(uint8_t pin, int value)
+{
+    analogValues[pin] = value;
+}
+
+bool pinLevel(uint8_t pin)
+{
+    volatile uint8_t *port = portOutputRegister(digitalPinToPort(pin));
+    return *port & digitalPinToBitMask(pin);
+}
+
+void eraseEeprom()
+{
+    memset(eeprom.memory, 0xFF, sizeof(eeprom.memory));
+}
+
+bool EchoTrace::load(const std::string &path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        return false;
+    }
+    readings.clear();
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        unsigned long ms;
+        unsigned int us;
+        char comma;
+        if (fields >> ms >> comma >> us && comma == ',')
+        {
+            readings.push_back(std::make_pair(ms, us));
+        }
+    }
+    return !readings.empty();
+}
+
+unsigned int EchoTrace::echoAt(unsigned long ms) const
+{
+    if (readings.empty())
+    {
+        return 0;
+    }
+    size_t i = 0;
+    while (i + 1 < readings.size() && readings[i + 1].first <= ms)
+    {
+        i++;
+    }
+    const std::pair<unsigned long, unsigned int> &before = readings[i];
+    if (ms <= before.first || i + 1 == readings.size() || before.second == 0 || readings[i + 1].second == 0)
+    {
+        return before.second;
+    }
+    const std::pair<unsigned long, unsigned int> &after = readings[i + 1];
+    return before.second + ((long)after.second - (long)before.second) * (long)(ms - before.first) /
+                               (long)(after.first - before.first);
+}
+
+} // namespace host
+
+using host::simTime;
+
+unsigned long millis()
+{
+    return timer0_millis;
+}
+
+unsigned long micros()
+{
+    return static_cast<unsigned long>(host::timer0Time);
+}
+
+uint16_t readTimer1()
+{
+    return static_cast<uint16_t>(host::timer0Time / 4);
+}
+
+void delay(unsigned long ms)
+{
+    host::advance(ms * 1000ULL);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    host::advance(us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    uint8_t port = digitalPinToPort(pin);
+    volatile uint8_t *ddr = port == 2 ? &DDRB : port == 3 ? &DDRC : &DDRD;
+    uint8_t mask = digitalPinToBitMask(pin);
+    if (mode == OUTPUT)
+    {
+        *ddr |= mask;
+    }
+    else
+    {
+        *ddr &= ~mask;
+        digitalWrite(pin, mode == INPUT_PULLUP ? HIGH : LOW);
+    }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    volatile uint8_t *port = portOutputRegister(digitalPinToPort(pin));
+    uint8_t mask = digitalPinToBitMask(pin);
+    if (value)
+    {
+        *port |= mask;
+    }
+    else
+    {
+        *port &= ~mask;
+    }
+}
+
+int digitalRead(uint8_t pin)
+{
+    if (pin < 8)
+    {
+        return PIND & _BV(pin) ? HIGH : LOW;
+    }
+    uint8_t port = digitalPinToPort(pin);
+    volatile uint8_t *ddr = port == 2 ? &DDRB : &DDRC;
+    uint8_t mask = digitalPinToBitMask(pin);
+    // Outputs read back what they drive, inputs such as the released I2C lines read high
+    return !(*ddr & mask) || host::pinLevel(pin) ? HIGH : LOW;
+}
+
+int analogRead(uint8_t pin)
+{
+    return pin < NUM_DIGITAL_PINS ? host::analogValues[pin] : 0;
+}
+
+long map(long value, long fromLow, long fromHigh, long toLow, long toHigh)
+{
+    return (value - fromLow) * (toHigh - toLow) / (fromHigh - fromLow) + toLow;
+}
+
+void noInterrupts()
+{
+    host::interruptsEnabled = false;
+}
+
+void interrupts()
+{
+    host::interruptsEnabled = true;
+    host::dispatch();
+}
+
+char *ltoa(long value, char *text, int base)
+{
+    char digits[34];
+    unsigned long magnitude = value < 0 && base == 10 ? -(unsigned long)value : (unsigned long)value;
+    int length = 0;
+    do
+    {
+        int digit = magnitude % base;
+        digits[length++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        magnitude /= base;
+    } while (magnitude > 0);
+
+    char *out = text;
+    if (value < 0 && base == 10)
+    {
+        *out++ = '-';
+    }
+    while (length > 0)
+    {
+        *out++ = digits[--length];
+    }
+    *out = '\0';
+    return text;
+}
+
+void set_sleep_mode(uint8_t mode)
+{
+    host::sleepMode = mode;
+}
+
+void sleep_enable()
+{
+    host::sleepEnabled = true;
+}
+
+void sleep_disable()
+{
+    host::sleepEnabled = false;
+}
+
+/**
+ * Idle wakes on the next interrupt, at the latest the Timer0 tick within a millisecond. Power-down stops Timer0,
+ * so millis() stands still until the watchdog or a button wakes the chip.
+ */
+void sleep_cpu()
+{
+    if (!host::sleepEnabled)
+    {
+        return;
+    }
+    host::slept = true;
+    host::woken = false;
+    if (host::sleepMode == SLEEP_MODE_PWR_DOWN)
+    {
+        host::poweredDown = true;
+        while (!host::woken)
+        {
+            unsigned long long next = host::nextEvent();
+            if (next == NEVER)
+            {
+                fprintf(stderr, "powered down with nothing to wake the chip\n");
+                abort();
+            }
+            host::advanceTo(next);
+        }
+        host::poweredDown = false;
+        return;
+    }
+    host::advanceTo(simTime + 1000 - host::timer0Time % 1000);
+}
+
+void wdt_reset()
+{
+    host::watchdogResetTime = simTime;
+}
+
+void wdt_disable()
+{
+    WDTCSR = 0;
+}
+
+void wdt_enable(uint8_t timeout)
+{
+    host::watchdogResetTime = simTime;
+    WDTCSR = _BV(WDE) | (timeout & 0x07) | (timeout & 0x08 ? _BV(WDP3) : 0);
+}
+
+void NewPing::ping_timer(void (*function)(), unsigned int distance)
+{
+    if (distance > 0)
+    {
+        maxDistance = min(distance, (unsigned int)MAX_SENSOR_DISTANCE);
+    }
+    timer_stop();
+
+    std::map<uint8_t, host::EchoTrace>::const_iterator trace = host::echoTraces.find(triggerPin);
+    unsigned int echo = trace == host::echoTraces.end() ? NO_ECHO : trace->second.echoAt(millis());
+    if (echo == NO_ECHO || echo > maxDistance * US_ROUNDTRIP_CM + US_ROUNDTRIP_CM / 2)
+    {
+        return;
+    }
+    ping_result = echo;
+    host::pinging = this;
+    host::echoFunction = function;
+    host::echoTime = simTime + TRIGGER_WIDTH + echo;
+}
+
+bool NewPing::check_timer()
+{
+    return host::echoArrived && host::pinging == this;
+}
+
+void NewPing::timer_stop()
+{
+    host::echoTime = NEVER;
+    host::pinging = NULL;
+}
+
+bool eeprom_is_ready()
+{
+    return simTime >= host::eeprom.busyUntil;
+}
+
+/**
+ * @brief Waits for the write cycle in progress to end, as avr-libc does before any EEPROM access.
+ */
+static void waitForEeprom()
+{
+    if (simTime < host::eeprom.busyUntil)
+    {
+        host::eeprom.blockedUs += host::eeprom.busyUntil - simTime;
+        host::advanceTo(host::eeprom.busyUntil);
+    }
+}
+
+uint8_t EEPROMClass::read(int address)
+{
+    waitForEeprom();
+    host::eeprom.reads++;
+    return host::eeprom.memory[address];
+}
+
+void EEPROMClass::write(int address, uint8_t value)
+{
+    waitForEeprom();
+    host::eeprom.memory[address] = value;
+    host::eeprom.writes++;
+    host::eeprom.wear[address]++;
+    host::eeprom.busyUntil = simTime + EEPROM_WRITE_TIME;
+}
+
+int HardwareSerial::read()
+{
+    if (input.empty())
+    {
+        return -1;
+    }
+    int value = input.front();
+    input.pop_front();
+    return value;
+}
+
+int HardwareSerial::availableForWrite()
+{
+    return SERIAL_TX_BUFFER_SIZE - 1 - static_cast<int>(output.size());
+}
+
+size_t HardwareSerial::write(uint8_t value)
+{
+    if (baud == 0)
+    {
+        return 1;
+    }
+    // A full buffer blocks until the UART has shifted a byte out
+    while (availableForWrite() <= 0)
+    {
+        host::advance(10000000UL / baud - lineTime);
+    }
+    output.push_back(value);
+    return 1;
+}
+
+void HardwareSerial::flush()
+{
+    while (baud > 0 && !output.empty())
+    {
+        host::advance(10000000UL / baud - lineTime);
+    }
+}
+
+void HardwareSerial::inject(const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (input.size() < SERIAL_RX_BUFFER_SIZE - 1)
+        {
+            input.push_back(data[i]);
+        }
+        else
+        {
+            droppedInput++;
+        }
+    }
+}
+
+void HardwareSerial::drain(unsigned long us)
+{
+    if (baud == 0 || output.empty())
+    {
+        lineTime = 0;
+        return;
+    }
+    unsigned long byteTime = 10000000UL / baud; // a start bit, eight data bits and a stop bit
+    lineTime += us;
+    while (lineTime >= byteTime && !output.empty())
+    {
+        sent += static_cast<char>(output.front());
+        output.pop_front();
+        lineTime -= byteTime;
+    }
+    if (output.empty())
+    {
+        lineTime = 0;
+    }
+}
@@ -0,0 +1,108 @@
+/**
+ * @file print.cpp
+ * @brief Number formatting of Print, digit for digit as the AVR core does it.
+ */
+#include <Arduino.h>
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+    while (size--)
+    {
+        if (!write(*buffer++))
+        {
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+size_t Print::print(long value, int base)
+{
+    if (base == 0)
+    {
+        return write(static_cast<uint8_t>(value));
+    }
+    if (base == 10 && value < 0)
+    {
+        size_t n = print('-');
+        return n + printNumber(-(unsigned long)value, 10);
+    }
+    return printNumber(static_cast<unsigned long>(value), base);
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+    if (base == 0)
+    {
+        return write(static_cast<uint8_t>(value));
+    }
+    return printNumber(value, base);
+}
+
+/**
+ * As the core prints floats: rounded to the digits asked for, and "ovf" beyond what an unsigned long holds.
+ */
+size_t Print::print(double value, int digits)
+{
+    if (isnan(value))
+    {
+        return print("nan");
+    }
+    if (isinf(value))
+    {
+        return print("inf");
+    }
+    if (value > 4294967040.0 || value < -4294967040.0)
+    {
+        return print("ovf");
+    }
+
+    size_t n = 0;
+    if (value < 0.0)
+    {
+        n += print('-');
+        value = -value;
+    }
+    double rounding = 0.5;
+    for (int i = 0; i < digits; i++)
+    {
+        rounding /= 10.0;
+    }
+    value += rounding;
+
+    unsigned long whole = static_cast<unsigned long>(value);
+    double remainder = value - static_cast<double>(whole);
+    n += print(whole);
+    if (digits > 0)
+    {
+        n += print('.');
+    }
+    while (digits-- > 0)
+    {
+        remainder *= 10.0;
+        unsigned int digit = static_cast<unsigned int>(remainder);
+        n += print(digit);
+        remainder -= digit;
+    }
+    return n;
+}
+
+size_t Print::printNumber(unsigned long value, uint8_t base)
+{
+    char text[8 * sizeof(long) + 1];
+    char *digit = &text[sizeof(text) - 1];
+    *digit = '\0';
+    if (base < 2)
+    {
+        base = 10;
+    }
+    do
+    {
+        char c = value % base;
+        value /= base;
+        *--digit = c < 10 ? c + '0' : c + 'A' - 10;
+    } while (value);
+    return write(digit);
+}
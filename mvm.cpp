@@ -15,561 +15,5508 @@
 #include <Adafruit_SSD1306.h>
 #include <EEPROM.h>
 #include <NewPing.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
 
-#define OLED_RESET 4
-Adafruit_SSD1306 display(128, 64, &Wire, OLED_RESET);
+// The board: pins, sizes and the EEPROM layout are typed constants, so they can be checked and derived at compile
+// time; the macros that remain are either tuning values or optional hardware switched on with #ifdef
+constexpr uint8_t OLED_RESET = 4;
+constexpr uint8_t ERROR_LED_PIN = 13; // the on-board LED, blinks when the display cannot be set up at all
+#define ERROR_BLINK_PERIOD 250 // ms the error LED is on, then off
+#define SERIAL_BAUD 115200 // up to 1000000, which a 16 MHz AVR hits exactly
+#define FRAME_MAX_PAYLOAD 32 // bytes in a serial frame before the CRC and the COBS encoding
+#define FRAME_TELEMETRY 0x01 // type of a TelemetryRecord frame
+#define TELEMETRY_CUTOFF 0x01 // the fill cutoff output is stopping the fill
+#define TELEMETRY_ALARM 0x02  // the fill alarm is raised
+#define TELEMETRY_VALID 0x04  // the tank is set up and the level estimate is valid
+#define TELEMETRY_INVALID_ECHO 0x08 // the echo of this record was missing or out of range, and was not filtered
+#define TELEMETRY_TANK_SHIFT 4 // the upper four bits of the flags are the tank the record is of
 
-#define TRIG_PIN A2
-#define ECHO_PIN A3
-NewPing sonar(TRIG_PIN, ECHO_PIN);
+// Commands arrive in the same frames as the telemetry goes out, each answered by a FRAME_ACK or a data frame
+#define COMMAND_PERIOD 10           // ms between polls of the serial receive buffer
+#define COMMAND_BUFFER_SIZE 24      // encoded bytes of the longest command frame
+#define CMD_GET_PROFILE 0x10        // [index] -> FRAME_PROFILE
+#define CMD_SET_PROFILE 0x11        // [index][MakgeolliTankSetting] -> FRAME_ACK
+#define CMD_GET_FIELD 0x12          // [row] -> FRAME_FIELD, rows as on the edit settings screen
+#define CMD_SET_FIELD 0x13          // [row][16-bit value, signed for VALUE_INT8 rows] -> FRAME_ACK, saves the profile of the tank shown
+#define CMD_SELECT 0x14             // [index] -> FRAME_ACK, makes a profile the setting of the tank shown
+#define CMD_CAPTURE 0x15            // -> FRAME_ACK, sets the minimum height with the tank empty, busy until a level is measured
+#define CMD_SET_POINT 0x16          // [table][point][GeometryPoint] -> FRAME_ACK
+#define CMD_SET_POINTS 0x17         // [table][count] -> FRAME_ACK, sets how many points of a table are in use
+#define CMD_DUMP 0x18               // -> every FRAME_PROFILE, FRAME_TABLE and FRAME_POINT, then FRAME_ACK
+#define CMD_TELEMETRY 0x19          // [0 or 1] -> FRAME_ACK, stops or starts the telemetry records
+#define FRAME_ACK 0x80              // [command][status]
+#define FRAME_PROFILE 0x81          // [index][MakgeolliTankSetting]
+#define FRAME_FIELD 0x82            // [row][int16 value]
+#define FRAME_TABLE 0x83            // [table][count]
+#define FRAME_POINT 0x84            // [table][point][GeometryPoint]
+#define STATUS_OK 0
+#define STATUS_BUSY 1               // a previous write is still pending or no level is measured yet, send the command again later
+#define STATUS_BAD 2                // unknown command, wrong length or value out of range
+#define DUMP_ITEMS (PROFILE_COUNT + GEOMETRY_TABLE_COUNT * (1 + GEOMETRY_TABLE_SIZE))
+#define NO_DUMP 0xFF
+#define CMD_DUMP_LOG 0x1A           // -> every FRAME_LOG_HOUR, FRAME_LOG_MINUTE, FRAME_LOG_SECOND, FRAME_EVENT and FRAME_TOTALS, then FRAME_ACK
+#define FRAME_LOG_HOUR 0x85         // [LogRecord without its CRC]
+#define FRAME_LOG_MINUTE 0x86       // [age in minutes][LogAggregate]
+#define FRAME_LOG_SECOND 0x87       // [age in seconds][uint16 volume, L]
+#define CMD_TANK 0x1B               // [tank] -> FRAME_ACK, shows a tank; profile and field commands act on it
+#define CMD_STATS 0x1C              // -> FRAME_STATS, then starts the maxima over
+#define FRAME_STATS 0x88            // [Stats][uint16 telemetry records dropped][uint16 task deadlines missed]
+#define CMD_TIMINGS 0x1D            // -> FRAME_TIMINGS, then starts the timings over
+#define FRAME_TIMINGS 0x89          // [uint16 minimum, mean, maximum ticks per TIMING_* section][uint16 free SRAM low-water]
+#define FRAME_EVENT 0x8A            // [age in events][FillEvent]
+#define FRAME_TOTALS 0x8B           // [profile][BatchTotals]
 
-#define BUTTON_UP_PIN 5
-#define BUTTON_DOWN_PIN 3
-#define BUTTON_LEFT_PIN 2
-#define BUTTON_RIGHT_PIN 6
-#define BUTTON_SELECT_PIN 7
+// Optional radio uplink: an ESP8266/ESP32 bridge or a LoRa module in transparent mode on a spare UART forwards
+// the same frames to a dashboard, batched per tank and sampled fast while a tank is filling or drawing off
+// #define UPLINK_SERIAL Serial1     // a hardware UART, e.g. Serial1 on a Mega or an ATmega328PB
+#define UPLINK_BAUD 9600
+#define UPLINK_METER_ID 1           // tells the frames of the meters on one dashboard apart
+#define UPLINK_PERIOD 100           // ms between polls of the uplink
+#define UPLINK_FAST_INTERVAL 2      // s between samples while a tank's level is moving
+#define UPLINK_SLOW_INTERVAL 60     // s between samples while all are still
+#define UPLINK_BATCH_TIME 300       // s a batch may span before it is sent, however few deltas it holds
+#define UPLINK_DELTA_BYTES (FRAME_MAX_PAYLOAD - 14) // room in a batch after its header
+#define UPLINK_MAX_DELTA_BYTES 5    // varint bytes of the largest volume change
+#define FRAME_UPLINK_BATCH 0x8C     // [UplinkBatch up to as many deltas as it holds]
+#define FRAME_UPLINK_EVENT 0x8D     // [meter][FillEvent]
+
+constexpr uint8_t OLED_ADDRESS = 0x3D;
+constexpr uint8_t OLED_WIDTH = 128;
+constexpr uint8_t OLED_HEIGHT = 64;
+#define OLED_DATA_CHUNK 31 // the AVR Wire buffer holds 32 bytes, one goes to the control byte
+#define OLED_I2C_CLOCK 400000 // Hz, the SSD1306 is specified to 400 kHz, most modules also run at 800000 or 1000000
+#define OLED_FLUSH_CHUNKS 2   // chunks sent per run of flushDisplay(), about 1.5 ms on the bus at 400 kHz
+#define OLED_WIRE_TIMEOUT 5000 // us a Wire transfer may hang before it is given up on and the TWI is reset
+#define DISPLAY_RETRY_PERIOD 1000 // ms between attempts to reconnect the display after a failed transfer
+#define LARGE_GLYPH_WIDTH 14  // columns of a large volume digit, each a byte per page
+#define LARGE_GLYPH_PAGES 3   // pages a large glyph covers, 24 rows
+#define LARGE_GLYPH_SPACING 2 // columns between large glyphs
+#define LARGE_SPACE_WIDTH 6   // columns a space takes in large text
+#define LARGE_GLYPH_DOT 10    // index of '.' in largeGlyphs, the digits come first
+#define LARGE_GLYPH_L 11
+#define NO_GLYPH 0xFF
+#define VOLUME_PAGE 2         // page the large volume readout starts on, rows 16 to 39
+#define PAGE_RENDERER         // draw each 8-pixel page on the fly into OLED_WIDTH bytes instead of keeping the 1 KB framebuffer,
+                              // which only fits next to the tanks and the stack on a chip with more than 2 KB of SRAM
+#define NO_PAGE 0xFF
+
+#if !defined(PAGE_RENDERER) && defined(RAMEND) && RAMEND <= 0x8FF
+#error "the 1 KB framebuffer leaves too little of 2 KB of SRAM, define PAGE_RENDERER"
+#endif
+
+#ifdef PAGE_RENDERER
+/**
+ * @brief SSD1306 driver that keeps a single 8-pixel page in RAM instead of the whole frame.
+ *
+ * Drawing only lands in the page picked with selectPage(), everything else is clipped away,
+ * so a frame goes to the panel by drawing the screen once per page and sending each page in turn.
+ * It has the calls of Adafruit_SSD1306 the sketch uses, for a 128x64 panel without rotation.
+ */
+class PageDisplay : public Adafruit_GFX
+{
+public:
+    PageDisplay(int8_t resetPin) : Adafruit_GFX(OLED_WIDTH, OLED_HEIGHT), resetPin(resetPin) {}
+
+    bool begin(uint8_t vccState, uint8_t address);
+    void selectPage(uint8_t index);
+    void clearDisplay();
+    void drawPixel(int16_t x, int16_t y, uint16_t color) override;
+    void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color) override;
+    void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color) override;
+    void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) override;
+    void invertDisplay(bool inverted);
+    void dim(bool dim);
+    void ssd1306_command(uint8_t command);
+    uint8_t *getBuffer() { return buffer; }
+    uint8_t *pageBuffer(uint8_t index) { return index == page ? buffer : NULL; }
+
+private:
+    int8_t resetPin;
+    uint8_t address = 0;
+    uint8_t contrast = 0;
+    uint8_t page = NO_PAGE; // page drawing lands in, NO_PAGE to only find out what changed
+    uint8_t buffer[OLED_WIDTH]; // one byte per column, bit 0 the top row of the page
+};
+
+PageDisplay display(OLED_RESET);
+#else
+// The library switches the bus to its second clock after every command, so both are the fast one
+Adafruit_SSD1306 display(OLED_WIDTH, OLED_HEIGHT, &Wire, OLED_RESET, OLED_I2C_CLOCK, OLED_I2C_CLOCK);
+#endif
+
+// Each sensor measures its own tank with its own profile; a tank costs about 175 bytes of RAM and 60 more for its snapshot,
+// and up to SETTINGS_DATA_SIZE - 1 fit into the record of the current setting indexes
+constexpr uint8_t TANK_COUNT = 1;
+#define NO_TANK 0xFF
+constexpr uint8_t TRIG_PIN = A2;
+constexpr uint8_t ECHO_PIN = A3;
+NewPing sonars[TANK_COUNT] = {NewPing(TRIG_PIN, ECHO_PIN)}; // e.g. {NewPing(A2, A3), NewPing(11, 12)}
+
+#define PING_INTERVAL 29     // ms between pings, NewPing needs ~29 ms for the previous echo to die out
+                             // the tanks are pinged in turn, so one sensor never hears another's echo
+#define SONAR_BUFFER_SIZE 8  // must be a power of two
+#define SONAR_MIN_DISTANCE 20  // mm, closer echoes are the transducer still ringing
+#define SONAR_RANGE_MARGIN 100 // mm beyond the bottom of the tank the sensor still listens for the echo
+#define ECHO_LOST_COUNT 8      // consecutive invalid echoes before the level counts as lost and the sensor searches its full range
+#define PING_MAX_BACKOFF 4     // most ping intervals a tank is skipped for after invalid echoes, doubling from one
+
+// #define TEMP_SENSOR_PIN A1             // optional TMP36, overrides the temperature configured per profile
+#define TEMPERATURE_PERIOD 1000           // ms between speed-of-sound updates
+#define DEFAULT_TEMPERATURE 20            // degrees C, used when a profile has no valid temperature
+
+#define LEVEL_MEDIAN_WINDOW 5             // pings in the sliding median, odd
+#define LEVEL_ALPHA 64                    // alpha-beta position gain in Q8 (0.25)
+#define LEVEL_BETA 9                      // alpha-beta rate gain in Q8, about alpha^2 / (2 - alpha)
+#define LEVEL_MAX_RESIDUAL (500L << 8)    // mm in Q8, larger jumps are followed gradually
+
+// #define ALARM_PIN 10                   // optional buzzer or lamp, driven high while the fill alarm is raised
+#define DEFAULT_ALARM_LEAD 10             // s before the target is reached that the fill alarm is raised
+#define MAX_ALARM_LEAD 120
+#define MIN_FILL_RATE 5                   // mL/s, slower than this the tank counts as not filling
+#define ETA_UNKNOWN 0xFFFF
+
+constexpr uint8_t CUTOFF_PIN = 8;       // pump relay or fill valve, high while filling is allowed
+#define CUTOFF_HYSTERESIS 10     // mm the level has to fall below the target before filling is allowed again
+#define CUTOFF_CONFIRM 2         // consecutive echoes across a threshold before the output switches
+#define CUTOFF_MAX_MISSES 3      // consecutive pings without an echo before the output fails safe
+const uint8_t cutoffPins[TANK_COUNT] = {CUTOFF_PIN}; // output of each tank, e.g. {CUTOFF_PIN, 9}
+
+constexpr uint8_t BUTTON_UP_PIN = 5;
+constexpr uint8_t BUTTON_DOWN_PIN = 3;
+constexpr uint8_t BUTTON_LEFT_PIN = 2;
+constexpr uint8_t BUTTON_RIGHT_PIN = 6;
+constexpr uint8_t BUTTON_SELECT_PIN = 7;
+// All on PORTD, so they are sampled with one read of PIND and share PCINT2
+constexpr uint8_t BUTTON_PIN_MASK =
+    _BV(BUTTON_UP_PIN) | _BV(BUTTON_DOWN_PIN) | _BV(BUTTON_LEFT_PIN) | _BV(BUTTON_RIGHT_PIN) | _BV(BUTTON_SELECT_PIN);
 
 #define MAIN_SCREEN 0
 #define MENU_SCREEN 1
 #define VIEW_SCREEN 2
 #define SETTINGS_SCREEN 3
 #define LOAD_SCREEN 4
+#define HISTORY_SCREEN 5
+#define DIAGNOSTICS_SCREEN 6
+#define CALIBRATE_SCREEN 7
+#define NO_SCREEN 0xFF
+
+#define VALUE_NONE 0   // menu item without a bound value
+#define VALUE_UINT8 1
+#define VALUE_INT8 2
+#define VALUE_UINT16 3
+
+#define ITEM_WRAP 0x01       // the value cycles from maximum to minimum, one step at a time
+#define ITEM_SHAPE_NAME 0x02 // the row shows shapeName() of the value instead of the label and the number
+#define ITEM_TANK 0x04       // the value is a member of tanks[0], and stands for that of the tank shown
+
+#define BUTTON_UP 0x01
+#define BUTTON_DOWN 0x02
+#define BUTTON_LEFT 0x04
+#define BUTTON_RIGHT 0x08
+#define BUTTON_SELECT 0x10
+#define BUTTON_COUNT 5
+
+#define BUTTON_PRESS 0
+#define BUTTON_RELEASE 1
+#define BUTTON_LONG_PRESS 2
+#define BUTTON_REPEAT 3
 
 #define DEBOUNCE_DELAY 100
 #define LONG_PRESS_TIME 2500
 #define POST_PRESS_IGNORE 10
+#define REPEAT_DELAY 500    // ms a key must be held before it starts repeating
+#define REPEAT_INTERVAL 100 // ms between repeats of a held key
+#define ACCELERATE_REPEATS 10 // repeats before a held key steps 5x, and 10x after twice as many
+#define BUTTON_QUEUE_SIZE 8   // must be a power of two
+
+#define INPUT_PERIOD 5     // ms, samples the keys at 200 Hz
+#define RENDER_PERIOD 50   // ms, fastest the screen is redrawn when something changed
+#define FLUSH_PERIOD 1     // ms, the dirty pages go out a few chunks at a time in between the other tasks
+#define PERSIST_PERIOD 10  // ms, one EEPROM byte per run so a write never has to wait for the previous one
+#define WARM_BOOT_PERIOD 1000 // ms between snapshots of the state a watchdog reset carries on from
+#define WATCHDOG_PRESCALER 6  // the watchdog resets the chip after 16 ms << 6, about 1 s, without a task finishing
+#define WARM_BOOT_MAGIC 0x4D57
+#define NO_TASK 0xFF
+
+#define SLOW_PING_INTERVAL 500   // ms between pings while every level is stable, bounds how late a new fill is seen
+#define LEVEL_STABLE_RATE 256    // mm/s in Q8 (1 mm/s), a level changing slower counts as stable
+#define LEVEL_STABLE_TIME 30000  // ms every level has to stay stable before the pings slow down
+#define DISPLAY_DIM_TIME 30000   // ms without a key press before the display is dimmed
+#define DISPLAY_OFF_TIME 120000  // ms without a key press before the display is turned off, unless an alarm is raised
+// #define POWER_DOWN_SLEEP      // power down instead of idling while the display is off, stops the UART so no host
+// Sections timed with Timer1, which runs free at clk / 64 for this (so analogWrite() on pins 9 and 10 is gone)
+#define TIMING_BUTTONS 0  // handleButtons()
+#define TIMING_SONAR 1    // updateSonar(), with the estimator, telemetry and log it feeds
+#define TIMING_RENDER 2   // updateDisplay(), drawing into the framebuffer
+#define TIMING_FLUSH 3    // flushDisplay() runs that sent something, the I2C transfer
+#define TIMING_SECTIONS 4
+#define NO_TIMING 0xFF
+#define TIMING_TICK_US 4  // us per Timer1 tick, a section may take up to 262 ms
+#define DIAGNOSTICS_PERIOD 1000 // ms between redraws of the diagnostics screen
+#define STACK_PAINT 0xA5  // free SRAM is filled with it at boot, so the deepest the stack got can be found later
+
+#define CALIBRATION_PINGS 32  // valid pings averaged for the empty level and for each calibration point
+#define CALIBRATION_IDLE 0
+#define CALIBRATION_EMPTY 1
+#define CALIBRATION_POINT 2
+
+#define DISPLAY_ON 0
+#define DISPLAY_DIM 1
+#define DISPLAY_OFF 2
+
+#define MAX_DIAMETER 4000     // mm, keeps the fixed-point volume math within 32 bits
+#define MIN_TEMPERATURE -40
+#define MAX_TEMPERATURE 80
+
+#define SHAPE_CYLINDER 0
+#define SHAPE_TAPERED 1 // frustum from bottomDiameter up to diameter over taperHeight, cylinder above
+#define SHAPE_TABLE 2   // height to volume table stored in EEPROM, e.g. from a calibration fill
+#define SHAPE_COUNT 3
+
+constexpr uint8_t PROFILE_COUNT = 10;        // profiles stored in EEPROM, only those of the tanks are kept in RAM
+#define NO_PROFILE 0xFF
+
+constexpr uint16_t SETTINGS_LOG_ADDRESS = 0;  // EEPROM address of the settings log
+constexpr uint8_t SETTINGS_LOG_SLOTS = 32;     // records in the log, the slots no key holds share the wear
+constexpr uint8_t SETTINGS_MIN_FREE_SLOTS = 8; // slots left over by SETTINGS_KEYS, fewer would wear them out within a few years
+constexpr uint8_t SETTINGS_RECORD_SIZE = 16;
+constexpr uint8_t SETTINGS_DATA_SIZE = 12;
+constexpr uint8_t SETTINGS_KEY_CURRENT = PROFILE_COUNT;    // record key of the current setting indexes, keys below it are the profiles
+constexpr uint8_t SETTINGS_KEY_TOTALS = PROFILE_COUNT + 1; // record key of the batch totals of profile 0, the other profiles follow
+constexpr uint8_t SETTINGS_KEYS = SETTINGS_KEY_TOTALS + PROFILE_COUNT;
+
+constexpr uint8_t GEOMETRY_TABLE_SIZE = 10;  // points per height to volume table
+constexpr uint8_t GEOMETRY_TABLE_COUNT = 5;  // profiles 0..GEOMETRY_TABLE_COUNT - 1 can use SHAPE_TABLE
+constexpr uint16_t GEOMETRY_TABLE_ADDRESS = SETTINGS_LOG_ADDRESS + SETTINGS_LOG_SLOTS * SETTINGS_RECORD_SIZE; // right after the settings log
+#define NO_SLOT 0xFF
+
+#define SETTINGS_DIRTY_PROFILE 0x01  // the setting of a tank with settingDirty has to be saved under its profile
+#define SETTINGS_DIRTY_CURRENT 0x02  // the profile index of each tank has to be saved
+#define SETTINGS_DIRTY_UPLOAD 0x04   // uploadSetting has to be saved under uploadKey
+#define SETTINGS_DIRTY_TOTALS 0x08   // the batch totals of a tank with totalsDirty have to be saved under its profile
+
+// Fills and draw-offs, found from the rate of the filtered level
+#define SESSION_IDLE 0
+#define SESSION_FILL 1
+#define SESSION_DRAW 2
+#define SESSION_START_TIME 5000      // ms the level has to keep rising or falling before a fill or draw-off starts
+#define SESSION_STOP_TIME 30000      // ms the level has to hold still before it ends, a reversal ends it at once
+#define SESSION_MIN_VOLUME 1000      // mL, smaller changes are left out of the totals and the events
+#define TOTALS_SAVE_DELAY 600000UL   // ms changed totals wait in RAM, so the batches of a busy hour share one record
+#define EVENT_LOG_SIZE 8             // fills and draw-offs kept in RAM for the log dump, must be a power of two
+
+// Fill history: per-second means and per-minute aggregates in RAM, per-hour aggregates in an append-only log
+// #define LOG_FRAM_ADDRESS 0x50     // optional I2C FRAM (e.g. MB85RC256V) for the hourly log instead of the EEPROM
+// LOG_ADDRESS and LOG_SLOTS follow from the sizes of the records, after their types below
+#define LOG_SECONDS 16               // per-second means kept in RAM
+#define LOG_MINUTES 16               // per-minute aggregates kept in RAM
+#define LOG_HOUR_MINUTES 60
+#define NO_LOG_DUMP 0xFFFF
+#define LOG_DUMP_ITEMS (LOG_SLOTS + LOG_MINUTES + LOG_SECONDS + EVENT_LOG_SIZE + PROFILE_COUNT)
+
+struct MakgeolliTankSetting
+{
+    uint16_t minHeight = 0;      // distance from the sensor to the bottom of the empty tank, mm
+    uint16_t diameter = 0;       // inner diameter of the tank, mm
+    uint16_t targetCapacity = 0; // L
+    int8_t temperature = DEFAULT_TEMPERATURE; // air temperature in the tank headspace, degrees C
+    uint8_t shape = SHAPE_CYLINDER;
+    uint16_t bottomDiameter = 0; // inner diameter at the bottom of a tapered tank, mm
+    uint16_t taperHeight = 0;    // height of the tapered section, mm
+};
+
+struct SettingsRecord
+{
+    uint16_t sequence; // increases with every record written, wrapping around
+    uint8_t key;       // profile index or SETTINGS_KEY_CURRENT
+    uint8_t data[SETTINGS_DATA_SIZE];
+    uint8_t crc;       // CRC-8 of all bytes before it
+};
+
+struct GeometryPoint
+{
+    uint16_t height; // mm above the bottom of the tank
+    uint32_t volume; // mL
+};
+
+struct GeometryTable
+{
+    uint8_t count; // points in use, heights strictly increasing
+    GeometryPoint points[GEOMETRY_TABLE_SIZE];
+};
+
+struct TankGeometry
+{
+    GeometryTable table;   // height to volume, evaluated by binary search and linear interpolation
+    uint32_t targetVolume; // mL
+    bool configured;
+};
+
+struct LevelEstimate
+{
+    int32_t distance;   // filtered distance to the surface, mm in Q8
+    int32_t rate;       // change of that distance, mm/s in Q8 (negative while filling)
+    unsigned long time; // ms of the last update
+    bool valid;
+};
+
+struct FillPrediction
+{
+    int32_t rate;             // mL/s, positive while filling
+    uint32_t remaining;       // mL below the target volume, 0 once it is reached
+    uint16_t secondsToTarget; // ETA_UNKNOWN unless filling
+    bool alarm;               // the target is reached within alarmLead seconds, or already was
+    uint8_t segment;          // height to volume table segment of the last sample
+};
+
+struct TelemetryRecord
+{
+    uint32_t time;     // ms the ping was sent
+    uint32_t volume;   // mL
+    uint16_t echoTime; // raw round-trip echo time, us, NO_ECHO if there was none
+    uint16_t height;   // filtered height of the surface above the bottom, mm
+    uint8_t type;      // FRAME_TELEMETRY
+    uint8_t sequence;  // increases by one per record, so the host can count dropped ones
+    uint8_t profile;   // profile of the tank
+    uint8_t flags;     // TELEMETRY_CUTOFF, TELEMETRY_ALARM, TELEMETRY_VALID, tank << TELEMETRY_TANK_SHIFT
+};
+
+struct LogAggregate
+{
+    uint16_t minimum; // L
+    uint16_t maximum; // L
+    uint16_t mean;    // L
+};
+
+struct LogRecord
+{
+    uint16_t sequence;  // increases with every hour logged, wrapping around
+    LogAggregate volume;
+    uint8_t profile;    // profile of the tank shown during the hour
+    uint8_t minutes;    // minutes with samples that went into it
+    uint8_t crc;        // CRC-8 of all bytes before it
+};
+
+struct LogAccumulator
+{
+    uint16_t minimum;
+    uint16_t maximum;
+    uint32_t sum;
+    uint16_t count;
+};
+
+struct BatchSession
+{
+    uint8_t state;           // SESSION_IDLE, or the fill or draw-off under way
+    uint8_t direction;       // what the level is doing now, in the same terms
+    unsigned long since;     // ms the level started doing it
+    uint32_t sinceVolume;    // mL in the tank then
+    unsigned long startTime; // ms the fill or draw-off started
+    uint32_t startVolume;    // mL in the tank then
+    uint16_t expected;       // s from the start to the target predicted when the fill was detected, 0 if unknown
+};
+
+struct BatchTotals
+{
+    uint32_t filled; // mL filled into tanks on the profile, over all its fills
+    uint32_t drawn;  // mL drawn off them
+    uint16_t fills;
+    uint16_t draws;
+};
+
+struct FillEvent
+{
+    uint32_t time;     // s since boot the fill or draw-off ended
+    int16_t volume;    // L filled, negative for a draw-off
+    uint16_t duration; // s
+    uint8_t tank;
+    uint8_t profile;
+    uint8_t target;    // duration in % of the time to the target predicted at the start, 0 for a draw-off
+};
+
+struct UplinkBatch
+{
+    uint8_t type;      // FRAME_UPLINK_BATCH
+    uint8_t meter;     // UPLINK_METER_ID
+    uint8_t profile;   // profile of the tank
+    uint8_t flags;     // TELEMETRY_CUTOFF, TELEMETRY_ALARM, TELEMETRY_VALID, tank << TELEMETRY_TANK_SHIFT
+    uint32_t time;     // s since boot of the first sample
+    uint32_t volume;   // mL at the first sample
+    uint16_t interval; // s between samples
+    uint8_t deltas[UPLINK_DELTA_BYTES]; // change from the sample before of each later one, mL, zigzag varints
+};
+
+struct Uplink
+{
+    UplinkBatch batch;
+    uint8_t length;      // bytes of batch.deltas in use
+    uint8_t count;       // samples in the batch, 0 if none is open
+    bool ready;          // the batch is complete and waits for room in the transmit buffer
+    uint32_t lastVolume; // mL at the last sample, the next delta is taken from it
+};
+
+struct Tank
+{
+    MakgeolliTankSetting setting; // the profile of the tank, other profiles are read from EEPROM when shown
+    TankGeometry geometry;        // precomputed from setting by updateTankGeometry()
+    uint8_t profile;
+    bool settingDirty;                 // changed since it was last saved under profile
+    uint8_t nextProfile = NO_PROFILE;  // profile selectProfile() queued, which persistSettings() switches to
+    uint16_t echoMmPerUs;         // mm of distance per us of echo time in Q16, set by updateTemperature()
+    uint16_t medianWindow[LEVEL_MEDIAN_WINDOW];
+    uint8_t medianNext;
+    uint8_t medianCount;
+    LevelEstimate estimate;
+    FillPrediction prediction;
+
+    // Echo validation, the range is set by updateEchoRange() from the tank's depth
+    volatile uint16_t minEchoTime;   // us, shorter echoes are invalid
+    volatile uint16_t rangeEchoTime; // us, longer echoes come from beyond the bottom of the tank and are invalid
+    uint16_t maxDistance;            // cm NewPing listens out to, so a missed echo times out early
+    uint8_t invalidEchoes;           // consecutive, up to ECHO_LOST_COUNT
+    bool searching;                  // the level was lost, the sensor listens over its whole range until an echo is valid
+    uint8_t backoff;                 // ping intervals the tank is skipped for after its next invalid echo
+    uint8_t holdoff;                 // ping intervals left until the tank is pinged again
+
+    // Fill cutoff, switched by pushSonarSample() as each echo arrives rather than by the render loop
+    volatile uint8_t *cutoffPort;
+    uint8_t cutoffMask;
+    volatile uint16_t cutoffEchoTime;  // us, echoes this short or shorter are at the target, 0 while there is none
+    volatile uint16_t releaseEchoTime; // us, echoes this long or longer are CUTOFF_HYSTERESIS below the target
+    volatile uint8_t cutoffVotes;      // consecutive echoes calling for the other state
+    volatile uint8_t missedEchoes;
+    volatile bool fillCutoff = true;   // fails safe until an echo shows the tank is below the target
+
+    // Batch tracking, the totals are of the tank's profile and saved under it
+    BatchSession session;
+    BatchTotals totals;
+    bool totalsDirty;            // changed since they were last saved
+    unsigned long totalsChanged; // ms of the first change since then
+};
+
+struct Stats
+{
+    uint32_t eepromWrites;     // EEPROM bytes written, unchanged ones are skipped without a write cycle
+    uint32_t displayBytes;     // I2C bytes sent to the panel by flushDisplay()
+    uint16_t frames;           // flushes that sent at least one page
+    uint16_t loopTime;         // us the tasks of the last loop pass took, sleep excluded
+    uint16_t maxLoopTime;      // us
+    uint16_t inputLatency;     // ms from the last key press being handled to its frame being on the panel
+    uint16_t maxInputLatency;  // ms
+    uint16_t pingTimeouts;     // pings that got no echo before the next one was due
+    uint16_t busRecoveries;    // times the I2C bus was cleared and the display set up again after a failed transfer
+    uint8_t watchdogResets;    // since the last cold boot
+    uint8_t stalledTask;       // index in tasks[] of the last task the watchdog caught hanging, NO_TASK if none
+};
+
+struct SectionTiming
+{
+    uint16_t minimum; // Timer1 ticks
+    uint16_t maximum; // Timer1 ticks
+    uint32_t total;   // Timer1 ticks
+    uint16_t count;   // runs timed, 0 if none yet
+};
+
+struct Calibration
+{
+    uint8_t state;           // CALIBRATION_IDLE, or what the pings are being averaged for
+    uint8_t pings;           // valid pings averaged so far
+    uint32_t distanceSum;    // mm in Q8 of those pings
+    uint16_t emptyDistance;  // mm from the sensor to the empty level, 0 until known
+    uint16_t added;          // L poured in since the last point, set on the screen
+    uint32_t volume;         // mL poured in since the empty level
+    uint8_t points;          // points recorded, table.points[0] is the empty level
+    uint32_t heightSum;      // sums over the points for the least-squares fit of volume to height, mm and mL
+    uint32_t volumeSum;
+    uint64_t heightSquares;  // sum of the squared heights
+    uint64_t heightVolumes;  // sum of the products of the heights and volumes
+    GeometryTable table;     // height above the empty level to volume, as recorded, last so a reset can keep it
+};
+
+struct ButtonEdge
+{
+    uint8_t button; // BUTTON_UP, BUTTON_DOWN, ...
+    bool pressed;
+    uint16_t time;  // low 16 bits of millis() when the edge was accepted
+};
+
+struct ShownRow
+{
+    long value;
+    bool highlighted;
+};
+
+struct MenuItem
+{
+    const char *label;  // PROGMEM string
+    void *value;        // bound value, NULL if type is VALUE_NONE
+    uint8_t type;       // VALUE_NONE, VALUE_UINT8, VALUE_INT8 or VALUE_UINT16
+    uint8_t flags;      // ITEM_WRAP, ITEM_SHAPE_NAME, ITEM_TANK
+    int8_t step;        // change per left/right press before acceleration, 0 if left/right do nothing
+    int16_t minimum;
+    uint16_t maximum;
+    void (*changed)();  // called after left/right changed the value, may be NULL
+    void (*select)();   // called on select, may be NULL
+    uint8_t screen;     // screen to show after select, NO_SCREEN to stay
+};
+
+struct MenuScreen
+{
+    const char *title;       // PROGMEM string drawn centered above the list, NULL for none
+    const MenuItem *items;   // PROGMEM items, NULL for none
+    uint8_t count;           // items drawn as rows, scrolled through MAX_ROWS at a time
+    uint8_t selectable;      // leading items up/down move through, the rest only show values
+    void (*draw)(bool);      // draws the rest of the screen, may be NULL
+    void (*enter)();         // called when the screen is shown, may be NULL
+    uint8_t back;            // screen select shows when no item is selectable
+};
+
+struct WarmTank
+{
+    uint8_t profile;
+    uint16_t medianWindow[LEVEL_MEDIAN_WINDOW];
+    uint8_t medianNext;
+    uint8_t medianCount;
+    LevelEstimate estimate;
+    BatchSession session;
+    BatchTotals totals;
+    bool totalsDirty;
+    unsigned long totalsChanged;
+};
+
+struct WarmBoot
+{
+    uint16_t magic;         // WARM_BOOT_MAGIC
+    uint8_t currentTank;
+    uint8_t watchdogResets; // since the last cold boot
+    WarmTank tanks[TANK_COUNT];
+    uint16_t crc;           // CRC-16 of all bytes before it
+};
+
+struct WatchdogStall
+{
+    uint16_t magic;     // WARM_BOOT_MAGIC while the record holds a stall, cleared once setup() has taken it
+    unsigned long time; // millis() when the watchdog caught the task
+    uint8_t task;       // index in tasks[] of the task, NO_TASK if it was in between tasks
+    uint8_t check;      // ~task, so what is in RAM after a power-up is not taken for a stall
+};
+
+struct Task
+{
+    void (*run)();
+    uint16_t period;        // ms between runs
+    uint16_t deadline;      // ms a run may start late before it counts as missed
+    unsigned long nextRun;
+    unsigned int missedDeadlines;
+    bool polled;            // only checks for work, so it is not woken for while there is none
+    uint8_t timing;         // TIMING_* section each run is timed in, NO_TIMING for none
+};
+
+// Where the hour log is, and how many hours it holds
+#ifdef LOG_FRAM_ADDRESS
+constexpr uint16_t LOG_ADDRESS = 0;
+constexpr uint16_t LOG_SLOTS = 2048; // 32 KB of FRAM, almost three months of hours
+#else
+constexpr uint16_t LOG_ADDRESS = GEOMETRY_TABLE_ADDRESS + GEOMETRY_TABLE_COUNT * sizeof(GeometryTable); // right after the geometry tables
+constexpr uint16_t LOG_SLOTS = (E2END + 1 - LOG_ADDRESS) / sizeof(LogRecord);
+#endif
+
+// The configuration is checked here, so a board with other pins, sizes or counts fails to build instead of misbehaving
+static_assert(BUTTON_PIN_MASK == (BUTTON_PIN_MASK & 0xFC) && BUTTON_SELECT_PIN < 8,
+              "the buttons must be on PORTD, digital pins 2-7, pins 0 and 1 are the serial port");
+static_assert(TANK_COUNT >= 1 && TANK_COUNT <= SETTINGS_DATA_SIZE - 1 && TANK_COUNT < 16,
+              "a tank's profile index is in the current record, and its number in TELEMETRY_TANK_SHIFT's four bits");
+static_assert(sizeof(cutoffPins) == TANK_COUNT * sizeof(cutoffPins[0]) && sizeof(sonars) == TANK_COUNT * sizeof(sonars[0]),
+              "each tank needs a sensor and a cutoff pin");
+static_assert(OLED_HEIGHT % 8 == 0 && OLED_HEIGHT <= 64, "dirtyPages has one bit per 8-pixel page");
+static_assert(sizeof(SettingsRecord) == SETTINGS_RECORD_SIZE, "settings records are SETTINGS_RECORD_SIZE bytes in EEPROM");
+static_assert(sizeof(MakgeolliTankSetting) <= SETTINGS_DATA_SIZE && sizeof(BatchTotals) <= SETTINGS_DATA_SIZE,
+              "profiles and batch totals are stored in settings records");
+static_assert(SETTINGS_LOG_SLOTS >= SETTINGS_KEYS + SETTINGS_MIN_FREE_SLOTS && SETTINGS_LOG_SLOTS < NO_SLOT,
+              "findFreeSlot() spreads the writes over the slots no key holds, so there have to be enough of them");
+static_assert(GEOMETRY_TABLE_COUNT <= PROFILE_COUNT, "geometry tables belong to the first profiles");
+#ifndef LOG_FRAM_ADDRESS
+static_assert(LOG_SLOTS >= 2 && LOG_ADDRESS + LOG_SLOTS * sizeof(LogRecord) <= E2END + 1, "the hour log does not fit the EEPROM");
+#endif
+static_assert((SONAR_BUFFER_SIZE & (SONAR_BUFFER_SIZE - 1)) == 0 && (BUTTON_QUEUE_SIZE & (BUTTON_QUEUE_SIZE - 1)) == 0 &&
+                  (EVENT_LOG_SIZE & (EVENT_LOG_SIZE - 1)) == 0,
+              "ring sizes must be powers of two");
+static_assert(LEVEL_MEDIAN_WINDOW % 2 == 1, "the median window must be odd");
+static_assert(offsetof(UplinkBatch, deltas) + UPLINK_DELTA_BYTES == FRAME_MAX_PAYLOAD &&
+                  UPLINK_DELTA_BYTES >= UPLINK_MAX_DELTA_BYTES && UPLINK_SLOW_INTERVAL <= UPLINK_BATCH_TIME,
+              "an uplink batch is one frame with room for at least one delta");
+static_assert(1 + sizeof(Stats) + 4 <= FRAME_MAX_PAYLOAD, "the stats have to fit into FRAME_STATS");
+#ifdef TEMP_SENSOR_PIN
+static_assert(TEMP_SENSOR_PIN != TRIG_PIN && TEMP_SENSOR_PIN != ECHO_PIN, "TEMP_SENSOR_PIN is a sensor pin");
+#endif
+#ifdef ALARM_PIN
+static_assert(ALARM_PIN != OLED_RESET && ALARM_PIN != TRIG_PIN && ALARM_PIN != ECHO_PIN && ALARM_PIN != CUTOFF_PIN &&
+                  (ALARM_PIN >= 8 || !(BUTTON_PIN_MASK & _BV(ALARM_PIN))),
+              "ALARM_PIN is already used by the display, the sensor, a cutoff or a button");
+#endif
+
+Tank tanks[TANK_COUNT];
+uint8_t currentTank = 0;            // tank shown and edited
+uint8_t loadIndex = 0;              // profile picked on the load screen
+MakgeolliTankSetting previewSetting; // profile loadIndex as read from EEPROM, shown on the load screen
+int currentScreen = MAIN_SCREEN;
+int menuItem = 0;
+
+// Completed sonar echo times (us) written by the echo timer interrupt, NO_ECHO (0) for a missed echo
+volatile uint16_t sonarBuffer[SONAR_BUFFER_SIZE];
+volatile uint8_t sonarTanks[SONAR_BUFFER_SIZE]; // tank of each sample
+volatile uint8_t sonarHead = 0; // free-running count of samples written, slot is sonarHead % SONAR_BUFFER_SIZE
+volatile bool pingPending = false;
+volatile uint8_t pingTank = 0;  // tank of the ping in flight
+unsigned long pingStartTime = 0;
 
-#define PI 3.14159265359
+int16_t airTemperature = DEFAULT_TEMPERATURE * 10; // tenths of a degree C, of the tank shown unless measured
+
+uint8_t estimatorTail = 0; // sonarHead value up to which samples have been filtered
+
+bool telemetryEnabled = true;
+uint8_t telemetrySequence = 0;
+uint16_t telemetryDropped = 0; // records skipped because the transmit buffer was full
+Stats stats;                    // what the firmware spends its time, bus and EEPROM on, read with CMD_STATS
+Calibration calibration;        // of the tank shown, started over when another tank is shown
+unsigned long inputTime = 0;    // ms a key press was handled that is not on the panel yet
+bool inputPending = false;
+bool inputDrawn = false;        // the frame showing it is drawn and being flushed
+SectionTiming timings[TIMING_SECTIONS];
+unsigned long shownDiagnosticsTime = 0;
+uint8_t alarmLead = DEFAULT_ALARM_LEAD; // s, saved with the current setting index
+
+// Debounced edges, single producer (pin change interrupt) and single consumer (handleButtons)
+volatile ButtonEdge buttonEdges[BUTTON_QUEUE_SIZE];
+volatile uint8_t buttonEdgeHead = 0; // free-running, only written by the producer
+volatile uint8_t buttonEdgeTail = 0; // free-running, only written by the consumer
+volatile uint8_t debouncedButtons = 0;
+volatile uint16_t lastEdgeTime[BUTTON_COUNT];
+
+uint8_t heldButton = 0; // button mask of the key being held, 0 if none
+uint16_t heldSince = 0;
+uint16_t nextRepeatTime = 0;
+uint8_t repeatCount = 0;
+bool longPressSent = false;
+
+bool displayDirty = true;
+uint8_t renderedSonarHead = 0;
+
+unsigned long lastInputTime = 0;  // ms of the last key press
+uint8_t displayPower = DISPLAY_ON; // DISPLAY_ON, DISPLAY_DIM or DISPLAY_OFF
+unsigned long stableSince = 0;    // ms since every level has been stable
+volatile bool watchdogWoke = false;
+extern volatile unsigned long timer0_millis; // what millis() counts, advanced over a power-down and kept by a warm boot
+volatile uint8_t runningTask = NO_TASK;      // index in tasks[] of the task being run, for the watchdog
+bool displayFault = false;                   // a transfer to the display failed, flushDisplay() reconnects it
+unsigned long displayFaultTime = 0;          // ms of the last failure or attempt to reconnect
+
+// Kept over a watchdog reset in .noinit, which the C runtime does not clear at boot
+WarmBoot warmBoot __attribute__((section(".noinit")));
+WatchdogStall watchdogStall __attribute__((section(".noinit")));
+uint8_t resetFlags __attribute__((section(".noinit"))); // MCUSR as found at boot, 0 if the bootloader cleared it
+
+// What is currently on the panel, so a frame only redraws and transfers what changed
+#define MAX_ROWS 5  // list rows that fit below the title
+int shownScreen = -1;
+uint8_t dirtyPages = 0; // one bit per 8-pixel SSD1306 page
+const uint8_t *flushData = NULL; // next framebuffer (or page buffer) byte of the window flushDisplay() is sending
+uint16_t flushRemaining = 0;     // bytes of that window left, 0 if none is open
+bool flushing = false;           // a frame is partly on the panel
+bool shownInverted = false;
+bool shownConfigured = false;
+long shownVolumeTenths = 0;
+int shownProgress = 0;
+int shownRateTenths = 0; // L/min in tenths
+uint16_t shownSecondsToTarget = ETA_UNKNOWN;
+ShownRow shownRows[MAX_ROWS];
+int listScroll = 0; // first row of the list shown in the top slot
+int shownListScroll = 0;
+
+uint8_t settingsDirty = 0; // SETTINGS_DIRTY_PROFILE, SETTINGS_DIRTY_CURRENT and SETTINGS_DIRTY_UPLOAD
+uint8_t persistKey = 0;    // key persistSettings() is writing, valid while persistOffset > 0
+uint8_t persistBit = 0;    // settingsDirty bit of that key
+uint8_t persistSlot = 0;
+uint8_t persistOffset = 0;
+SettingsRecord pendingRecord;
+
+uint8_t recordSlots[SETTINGS_KEYS]; // slot of the latest record of each key, NO_SLOT if there is none
+uint8_t nextSlot = 0;
+uint16_t nextSequence = 0;
+
+// A profile other than the active one, or part of a geometry table, received over the serial port
+uint8_t uploadKey = 0;
+MakgeolliTankSetting uploadSetting;
+uint16_t stagedAddress = 0; // EEPROM address of the staged bytes
+uint8_t stagedData[sizeof(GeometryPoint)];
+const uint8_t *stagedSource = stagedData; // the bytes being written, stagedData or a whole table in RAM
+uint8_t stagedLength = 0;   // bytes left to write, 0 if nothing is staged
+uint8_t stagedOffset = 0;
+
+uint8_t commandBuffer[COMMAND_BUFFER_SIZE];
+uint8_t commandLength = 0; // encoded bytes received since the last zero, more than COMMAND_BUFFER_SIZE if too long
+uint8_t dumpItem = NO_DUMP; // next item CMD_DUMP sends
+uint16_t logDumpItem = NO_LOG_DUMP; // next item CMD_DUMP_LOG sends
+
+uint16_t logSeconds[LOG_SECONDS];
+LogAggregate logMinutes[LOG_MINUTES];
+uint16_t logSecondCount = 0; // free-running count of seconds logged, slot is logSecondCount % LOG_SECONDS
+FillEvent fillEvents[EVENT_LOG_SIZE];
+uint16_t fillEventCount = 0; // free-running count of events, slot is fillEventCount % EVENT_LOG_SIZE
+uint16_t logMinuteCount = 0; // free-running count of minutes logged, slot is logMinuteCount % LOG_MINUTES
+LogAccumulator secondAccumulator;
+LogAccumulator minuteAccumulator;
+LogAccumulator hourAccumulator; // sums the minute means
+unsigned long secondStart = 0;
+unsigned long minuteStart = 0;
+uint8_t hourMinutes = 0;     // minutes into the hour
+LogRecord pendingLogRecord;
+uint8_t logWriteOffset = 0;  // bytes of pendingLogRecord written, sizeof(LogRecord) if none is pending
+uint16_t logSlot = 0;        // slot the next hour goes into
+uint16_t logSequence = 0;
+uint16_t shownLogMinuteCount = 0;
+
+#ifdef UPLINK_SERIAL
+Uplink uplinks[TANK_COUNT];
+uint32_t uplinkSampleTime = 0; // s since boot of the last sample
+uint16_t uplinkEventCount = 0; // fillEventCount value up to which the events were sent
+#endif
+
+// UI text lives in flash and is printed straight from there, so none of it is copied into SRAM at boot
+#ifndef FPSTR
+#define FPSTR(s) (reinterpret_cast<const __FlashStringHelper *>(s)) // a PROGMEM string for print()
+#endif
+const char labelMenu[] PROGMEM = "Menu";
+const char labelHistory[] PROGMEM = "History";
+const char labelDiagnostics[] PROGMEM = "Diagnostics";
+const char labelCalibrate[] PROGMEM = "Calibrate";
+const char labelCalibrationEmpty[] PROGMEM = "Empty: ";
+const char labelCalibrationAdded[] PROGMEM = "Added L: ";
+const char labelCalibrationPoint[] PROGMEM = "Add Point: ";
+const char labelFitCylinder[] PROGMEM = "Fit Cylinder";
+const char labelBuildTable[] PROGMEM = "Build Table";
+const char labelTimingButtons[] PROGMEM = "Keys";
+const char labelTimingSonar[] PROGMEM = "Sonar";
+const char labelTimingRender[] PROGMEM = "Draw";
+const char labelTimingFlush[] PROGMEM = "I2C";
+const char labelMainScreen[] PROGMEM = "Main Screen";
+const char labelViewSettings[] PROGMEM = "View Settings";
+const char labelEditSettings[] PROGMEM = "Edit Settings";
+const char labelLoadSettings[] PROGMEM = "Load Settings";
+const char labelSaveSettings[] PROGMEM = "Save Settings";
+const char labelIndex[] PROGMEM = "index: ";
+const char labelMinHeight[] PROGMEM = "Min Height: ";
+const char labelDiameter[] PROGMEM = "Diameter:";
+const char labelTargetCapacity[] PROGMEM = "Target Capacity:";
+const char labelTemperature[] PROGMEM = "Temperature:";
+const char labelBottomDiameter[] PROGMEM = "Bottom Dia:";
+const char labelTaperHeight[] PROGMEM = "Taper Height:";
+const char labelAlarmLead[] PROGMEM = "Alarm Lead:";
+const char labelCylinder[] PROGMEM = "Shape: Cylinder";
+const char labelTapered[] PROGMEM = "Shape: Tapered";
+const char labelTable[] PROGMEM = "Shape: Table";
+
+const char *const shapeLabels[SHAPE_COUNT] PROGMEM = {labelCylinder, labelTapered, labelTable};
+const char *const timingLabels[TIMING_SECTIONS] PROGMEM = {labelTimingButtons, labelTimingSonar, labelTimingRender,
+                                                            labelTimingFlush};
+
+// Seven-segment digits, '.' and 'L' for the volume readout, in the SSD1306 page layout:
+// LARGE_GLYPH_PAGES rows of LARGE_GLYPH_WIDTH column bytes, bit 0 the top pixel of the column
+const uint8_t largeGlyphs[][LARGE_GLYPH_PAGES * LARGE_GLYPH_WIDTH] PROGMEM = {
+    // '0'
+    {0xFE, 0xFD, 0xFB, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0xFB, 0xFD, 0xFE,
+     0xF7, 0xE3, 0xC1, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC1, 0xE3, 0xF7,
+     0x7F, 0xBF, 0xDF, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xDF, 0xBF, 0x7F},
+    // '1'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xF8, 0xFC, 0xFE,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC1, 0xE3, 0xF7,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F, 0x3F, 0x7F},
+    // '2'
+    {0x00, 0x01, 0x03, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0xFB, 0xFD, 0xFE,
+     0xF0, 0xE8, 0xDC, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1D, 0x0B, 0x07,
+     0x7F, 0xBF, 0xDF, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xC0, 0x80, 0x00},
+    // '3'
+    {0x00, 0x01, 0x03, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0xFB, 0xFD, 0xFE,
+     0x00, 0x08, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0xDD, 0xEB, 0xF7,
+     0x00, 0x80, 0xC0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xDF, 0xBF, 0x7F},
+    // '4'
+    {0xFE, 0xFC, 0xF8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xF8, 0xFC, 0xFE,
+     0x07, 0x0B, 0x1D, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0xDD, 0xEB, 0xF7,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F, 0x3F, 0x7F},
+    // '5'
+    {0xFE, 0xFD, 0xFB, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x03, 0x01, 0x00,
+     0x07, 0x0B, 0x1D, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0xDC, 0xE8, 0xF0,
+     0x00, 0x80, 0xC0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xDF, 0xBF, 0x7F},
+    // '6'
+    {0xFE, 0xFD, 0xFB, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x03, 0x01, 0x00,
+     0xF7, 0xEB, 0xDD, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0xDC, 0xE8, 0xF0,
+     0x7F, 0xBF, 0xDF, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xDF, 0xBF, 0x7F},
+    // '7'
+    {0x00, 0x01, 0x03, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0xFB, 0xFD, 0xFE,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC1, 0xE3, 0xF7,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F, 0x3F, 0x7F},
+    // '8'
+    {0xFE, 0xFD, 0xFB, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0xFB, 0xFD, 0xFE,
+     0xF7, 0xEB, 0xDD, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0xDD, 0xEB, 0xF7,
+     0x7F, 0xBF, 0xDF, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xDF, 0xBF, 0x7F},
+    // '9'
+    {0xFE, 0xFD, 0xFB, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0xFB, 0xFD, 0xFE,
+     0x07, 0x0B, 0x1D, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0xDD, 0xEB, 0xF7,
+     0x00, 0x80, 0xC0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xDF, 0xBF, 0x7F},
+    // '.'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0xE0, 0xE0, 0xE0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+    // 'L'
+    {0xFE, 0xFC, 0xF8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0xF7, 0xE3, 0xC1, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x7F, 0xBF, 0xDF, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xE0, 0xC0, 0x80, 0x00},
+};
+const uint8_t largeGlyphWidths[] PROGMEM = {14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 3, 14};
+
+void handleButtons();
+void updateSonar();
+void updateTemperature();
+void updateDisplay();
+void flushDisplay();
+void persistSettings();
+void pollCommands();
+void updateUplink();
+void saveWarmBoot();
+
+Task tasks[] = {
+    {handleButtons, INPUT_PERIOD, INPUT_PERIOD, 0, 0, true, TIMING_BUTTONS},
+    {updateSonar, PING_INTERVAL, PING_INTERVAL / 2, 0, 0, false, TIMING_SONAR},
+    {updateTemperature, TEMPERATURE_PERIOD, TEMPERATURE_PERIOD, 0, 0, false, NO_TIMING},
+    {updateDisplay, RENDER_PERIOD, RENDER_PERIOD, 0, 0, true, TIMING_RENDER},
+    {flushDisplay, FLUSH_PERIOD, FLUSH_PERIOD * 5, 0, 0, true, NO_TIMING},
+    {persistSettings, PERSIST_PERIOD, PERSIST_PERIOD * 10, 0, 0, true, NO_TIMING},
+    {pollCommands, COMMAND_PERIOD, COMMAND_PERIOD * 5, 0, 0, true, NO_TIMING},
+    {saveWarmBoot, WARM_BOOT_PERIOD, WARM_BOOT_PERIOD, 0, 0, true, NO_TIMING},
+#ifdef UPLINK_SERIAL
+    {updateUplink, UPLINK_PERIOD, UPLINK_PERIOD * 10, 0, 0, true, NO_TIMING},
+#endif
+};
+
+void updateMainScreen(bool redraw);
+void updateViewSettingsScreen(bool redraw);
+void updateCurrentGeometry();
+void captureMinHeight();
+void saveSettings();
+void enterLoadScreen();
+void loadPreview();
+void loadPickedProfile();
+void updateHistoryScreen(bool redraw);
+void updateDiagnosticsScreen(bool redraw);
+void enterCalibrateScreen();
+void captureEmptyLevel();
+void captureCalibrationPoint();
+void applyCylinderFit();
+void applyCalibrationTable();
+
+// The list screens, each row bound to the value it shows and edits
+const MenuItem menuItems[] PROGMEM = {
+    {labelMainScreen, NULL, VALUE_NONE, 0, 0, 0, 0, NULL, NULL, MAIN_SCREEN},
+    {labelViewSettings, NULL, VALUE_NONE, 0, 0, 0, 0, NULL, NULL, VIEW_SCREEN},
+    {labelEditSettings, NULL, VALUE_NONE, 0, 0, 0, 0, NULL, NULL, SETTINGS_SCREEN},
+    {labelLoadSettings, NULL, VALUE_NONE, 0, 0, 0, 0, NULL, NULL, LOAD_SCREEN},
+    {labelHistory, NULL, VALUE_NONE, 0, 0, 0, 0, NULL, NULL, HISTORY_SCREEN},
+    {labelDiagnostics, NULL, VALUE_NONE, 0, 0, 0, 0, NULL, NULL, DIAGNOSTICS_SCREEN},
+    {labelCalibrate, NULL, VALUE_NONE, 0, 0, 0, 0, NULL, NULL, CALIBRATE_SCREEN},
+};
+
+const MenuItem editItems[] PROGMEM = {
+    {labelMinHeight, &tanks[0].setting.minHeight, VALUE_UINT16, ITEM_TANK, 0, 0, 65535, NULL, captureMinHeight, NO_SCREEN},
+    {labelDiameter, &tanks[0].setting.diameter, VALUE_UINT16, ITEM_TANK, 10, 0, MAX_DIAMETER, updateCurrentGeometry, NULL, NO_SCREEN},
+    {labelTargetCapacity, &tanks[0].setting.targetCapacity, VALUE_UINT16, ITEM_TANK, 10, 0, 65535, updateCurrentGeometry, NULL, NO_SCREEN},
+    {labelTemperature, &tanks[0].setting.temperature, VALUE_INT8, ITEM_TANK, 1, MIN_TEMPERATURE, MAX_TEMPERATURE, NULL, NULL, NO_SCREEN},
+    {NULL, &tanks[0].setting.shape, VALUE_UINT8, ITEM_WRAP | ITEM_SHAPE_NAME | ITEM_TANK, 1, 0, SHAPE_COUNT - 1, updateCurrentGeometry, NULL, NO_SCREEN},
+    {labelBottomDiameter, &tanks[0].setting.bottomDiameter, VALUE_UINT16, ITEM_TANK, 10, 0, MAX_DIAMETER, updateCurrentGeometry, NULL, NO_SCREEN},
+    {labelTaperHeight, &tanks[0].setting.taperHeight, VALUE_UINT16, ITEM_TANK, 10, 0, 65535, updateCurrentGeometry, NULL, NO_SCREEN},
+    {labelAlarmLead, &alarmLead, VALUE_UINT8, 0, 1, 1, MAX_ALARM_LEAD, NULL, NULL, NO_SCREEN},
+    {labelSaveSettings, NULL, VALUE_NONE, 0, 0, 0, 0, NULL, saveSettings, MENU_SCREEN},
+};
+
+// Empty the tank, capture the empty level, then pour in known litres and add a point after each pour
+const MenuItem calibrateItems[] PROGMEM = {
+    {labelCalibrationEmpty, &calibration.emptyDistance, VALUE_UINT16, 0, 0, 0, 0, NULL, captureEmptyLevel, NO_SCREEN},
+    {labelCalibrationAdded, &calibration.added, VALUE_UINT16, 0, 1, 0, 65535, NULL, NULL, NO_SCREEN},
+    {labelCalibrationPoint, &calibration.points, VALUE_UINT8, 0, 0, 0, 0, NULL, captureCalibrationPoint, NO_SCREEN},
+    {labelFitCylinder, NULL, VALUE_NONE, 0, 0, 0, 0, NULL, applyCylinderFit, VIEW_SCREEN},
+    {labelBuildTable, NULL, VALUE_NONE, 0, 0, 0, 0, NULL, applyCalibrationTable, VIEW_SCREEN},
+};
+
+const MenuItem loadItems[] PROGMEM = {
+    {labelIndex, &loadIndex, VALUE_UINT8, 0, 1, 0, PROFILE_COUNT - 1, loadPreview, NULL, NO_SCREEN},
+    {labelLoadSettings, NULL, VALUE_NONE, 0, 0, 0, 0, NULL, loadPickedProfile, MENU_SCREEN},
+    {labelMinHeight, &previewSetting.minHeight, VALUE_UINT16, 0, 0, 0, 0, NULL, NULL, NO_SCREEN},
+    {labelDiameter, &previewSetting.diameter, VALUE_UINT16, 0, 0, 0, 0, NULL, NULL, NO_SCREEN},
+    {labelTargetCapacity, &previewSetting.targetCapacity, VALUE_UINT16, 0, 0, 0, 0, NULL, NULL, NO_SCREEN},
+};
+
+#define ITEM_COUNT(items) (sizeof(items) / sizeof(MenuItem))
+
+// Indexed by the *_SCREEN numbers
+const MenuScreen screens[] PROGMEM = {
+    {NULL, NULL, 0, 0, updateMainScreen, NULL, MENU_SCREEN},
+    {labelMenu, menuItems, ITEM_COUNT(menuItems), ITEM_COUNT(menuItems), NULL, NULL, NO_SCREEN},
+    {labelViewSettings, NULL, 0, 0, updateViewSettingsScreen, NULL, MENU_SCREEN},
+    {labelEditSettings, editItems, ITEM_COUNT(editItems), ITEM_COUNT(editItems), NULL, NULL, NO_SCREEN},
+    {labelLoadSettings, loadItems, ITEM_COUNT(loadItems), 2, NULL, enterLoadScreen, NO_SCREEN},
+    {labelHistory, NULL, 0, 0, updateHistoryScreen, NULL, MENU_SCREEN},
+    {labelDiagnostics, NULL, 0, 0, updateDiagnosticsScreen, NULL, MENU_SCREEN},
+    {labelCalibrate, calibrateItems, ITEM_COUNT(calibrateItems), ITEM_COUNT(calibrateItems), NULL, enterCalibrateScreen, NO_SCREEN},
+};
+
+/**
+ * @brief Initializes the necessary components and settings for the program.
+ *
+ * This function is called once at the beginning of the program.
+ * It sets up the serial communication, pin modes for buttons and sensors,
+ * and initializes the display.
+ */
+void setup()
+{
+    Serial.begin(SERIAL_BAUD);
+#ifdef UPLINK_SERIAL
+    UPLINK_SERIAL.begin(UPLINK_BAUD);
+#endif
+
+    pinMode(BUTTON_UP_PIN, INPUT_PULLUP);
+    pinMode(BUTTON_DOWN_PIN, INPUT_PULLUP);
+    pinMode(BUTTON_LEFT_PIN, INPUT_PULLUP);
+    pinMode(BUTTON_RIGHT_PIN, INPUT_PULLUP);
+    pinMode(BUTTON_SELECT_PIN, INPUT_PULLUP);
+
+    // Pin change interrupts on the button pins, all of them are on PORTD (PCINT16..23)
+    debouncedButtons = readButtons();
+    PCMSK2 |= BUTTON_PIN_MASK;
+    PCIFR |= _BV(PCIF2);
+    PCICR |= _BV(PCIE2);
+
+    if (!display.begin(SSD1306_SWITCHCAPVCC, OLED_ADDRESS))
+    {
+#ifdef PAGE_RENDERER
+        // The panel did not answer, flushDisplay() keeps trying to reconnect it while the tanks are measured
+        failDisplay();
+#else
+        // The framebuffer could not be allocated, which no retry changes
+        haltWithError();
+#endif
+    }
+    display.clearDisplay();
+#ifdef WIRE_HAS_TIMEOUT
+    // A transfer hung by the display or a glitch on the bus fails instead of blocking the loop, and the TWI is reset
+    Wire.setWireTimeout(OLED_WIRE_TIMEOUT, true);
+#endif
+
+    // Timer1 free-running at clk / 64 timestamps the timed sections
+    TCCR1A = 0;
+    TCCR1B = _BV(CS11) | _BV(CS10);
+    paintStack();
+
+    scanSettingsLog();
+    scanHourLog();
+
+    // Setting index of the first tank, alarm lead, then the setting indexes of the other tanks
+    uint8_t current[1 + TANK_COUNT] = {0, DEFAULT_ALARM_LEAD};
+    loadSettingsRecord(SETTINGS_KEY_CURRENT, current, sizeof(current));
+    alarmLead = current[1] >= 1 && current[1] <= MAX_ALARM_LEAD ? current[1] : DEFAULT_ALARM_LEAD;
+
+    // After the watchdog caught a hanging task, carry on from the last snapshot rather than from empty filters
+    // A power-up or brown-out leaves random RAM, so the record only counts without one and with its magic
+    bool stalled = !(resetFlags & (_BV(PORF) | _BV(BORF))) && watchdogStall.magic == WARM_BOOT_MAGIC &&
+                   watchdogStall.check == (uint8_t)~watchdogStall.task;
+    bool warm = stalled && validWarmBoot();
+
+#ifdef ALARM_PIN
+    pinMode(ALARM_PIN, OUTPUT);
+#endif
+    for (uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        Tank &tank = tanks[i];
+
+        // If there is garbage value in the initial value when booting after the initial ROM write, set the initial value
+        uint8_t index = current[i == 0 ? 0 : 1 + i];
+        tank.profile = index < PROFILE_COUNT ? index : 0; // 초기값
+        if (warm)
+        {
+            tank.profile = warmBoot.tanks[i].profile;
+        }
+
+        // The output is written from the echo interrupt, so its port and bit are looked up once
+        tank.cutoffPort = portOutputRegister(digitalPinToPort(cutoffPins[i]));
+        tank.cutoffMask = digitalPinToBitMask(cutoffPins[i]);
+        digitalWrite(cutoffPins[i], LOW);
+        pinMode(cutoffPins[i], OUTPUT);
+
+        loadProfile(tank.profile, tank.setting);
+        loadTotals(tank);
+        updateTankGeometry(tank);
+    }
+
+    stats.stalledTask = NO_TASK;
+    if (stalled)
+    {
+        stats.watchdogResets = (warm ? warmBoot.watchdogResets : 0) + 1;
+        stats.stalledTask = watchdogStall.task;
+    }
+    watchdogStall.magic = 0;
+    if (warm)
+    {
+        restoreWarmBoot();
+    }
+    warmBoot.magic = 0;
+    updateTemperature();
+
+    unsigned long now = millis();
+    for (Task &task : tasks)
+    {
+        task.nextRun = now;
+    }
+    startWatchdog();
+}
+
+/**
+ * @brief The main loop function that runs repeatedly in the program.
+ *
+ * This function runs the scheduler: every task whose period has elapsed is run once, in table order.
+ * Sensing, input, rendering and persistence each keep their own rate instead of sharing a fixed delay,
+ * and the MCU sleeps until the next one is due. The watchdog is reset after every task, so one that hangs
+ * resets the chip.
+ */
+void loop()
+{
+    unsigned long start = micros();
+    for (Task &task : tasks)
+    {
+        unsigned long now = millis();
+        if ((long)(now - task.nextRun) < 0)
+        {
+            continue;
+        }
+
+        if (now - task.nextRun > task.deadline)
+        {
+            task.missedDeadlines++;
+        }
+
+        uint16_t started = TCNT1;
+        runningTask = &task - tasks;
+        task.run();
+        runningTask = NO_TASK;
+        wdt_reset();
+        if (task.timing != NO_TIMING)
+        {
+            addTiming(task.timing, started);
+        }
+
+        // Keep a fixed rate, but don't try to catch up on runs that were missed entirely
+        task.nextRun += task.period;
+        if ((long)(now - task.nextRun) >= 0)
+        {
+            task.nextRun = now + task.period;
+        }
+    }
+
+    stats.loopTime = min(micros() - start, 0xFFFFUL);
+    stats.maxLoopTime = max(stats.maxLoopTime, stats.loopTime);
+    sleepUntilNextTask();
+}
+
+/**
+ * @brief Sleeps until the next task is due.
+ *
+ * The MCU idles with its CPU clock stopped until the next interrupt. Timer0 keeps millis() running and wakes it
+ * every ms, and the echo timer, the UART and the pin change interrupts keep working.
+ * With POWER_DOWN_SLEEP the whole chip powers down instead while there is nothing to do but wait for the next ping.
+ */
+void sleepUntilNextTask()
+{
+    unsigned long now = millis();
+    long wait = (long)(tasks[0].nextRun - now);
+    for (const Task &task : tasks)
+    {
+        wait = min(wait, (long)(task.nextRun - now));
+    }
+    if (wait <= 0)
+    {
+        return;
+    }
+
+#ifdef POWER_DOWN_SLEEP
+    if (canPowerDown())
+    {
+        powerDown();
+        return;
+    }
+#endif
+
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_enable();
+    sleep_cpu();
+    sleep_disable();
+}
+
+/**
+ * @brief Checks whether the polled tasks have nothing to do, so the chip may power down.
+ *
+ * Power-down stops Timer0, the UART and the echo timer, so it waits for the display to be off,
+ * for no key to be held, echo to be in flight, byte to be written or frame to be sent,
+ * and for the telemetry to be turned off, since a host could not get its commands through.
+ *
+ * @return True if nothing but the next ping or temperature update is pending.
+ */
+bool canPowerDown()
+{
+    if (displayPower != DISPLAY_OFF || telemetryEnabled || pingPending || dirtyPages || flushRemaining > 0)
+    {
+        return false;
+    }
+    if (heldButton || debouncedButtons || buttonEdgeHead != buttonEdgeTail)
+    {
+        return false;
+    }
+    if (settingsDirty || stagedLength > 0 || logWriteOffset < sizeof(LogRecord) || !eeprom_is_ready())
+    {
+        return false;
+    }
+    for (const Tank &tank : tanks)
+    {
+        if (tank.nextProfile != NO_PROFILE)
+        {
+            return false;
+        }
+    }
+    if (dumpItem != NO_DUMP || logDumpItem != NO_LOG_DUMP || commandLength > 0)
+    {
+        return false;
+    }
+#ifdef UPLINK_SERIAL
+    if (uplinkEventCount != fillEventCount || UPLINK_SERIAL.availableForWrite() < SERIAL_TX_BUFFER_SIZE - 1)
+    {
+        return false;
+    }
+    for (const Uplink &uplink : uplinks)
+    {
+        if (uplink.ready)
+        {
+            return false;
+        }
+    }
+#endif
+    return Serial.availableForWrite() >= SERIAL_TX_BUFFER_SIZE - 1;
+}
+
+/**
+ * @brief Powers the chip down until the next task that is not polled is due, or a key is pressed.
+ *
+ * The watchdog interrupt is the wake-up timer, in steps of 16 ms doubling up to 8 s, rounded down to the wait.
+ * millis() stops meanwhile, so it is advanced by the time the watchdog slept; after a key wakes the chip it
+ * is behind by up to that time, which only delays the next ping. The polled tasks start over from the wake-up.
+ * Meanwhile the watchdog cannot reset the chip, it is started as the supervisor again after.
+ */
+void powerDown()
+{
+    unsigned long now = millis();
+    long wait = 0x7FFFFFFFL;
+    for (const Task &task : tasks)
+    {
+        if (!task.polled)
+        {
+            wait = min(wait, (long)(task.nextRun - now));
+        }
+    }
+    if (wait < 16)
+    {
+        return;
+    }
+
+    uint8_t prescaler = 0; // the watchdog sleeps 16 ms << prescaler
+    while (prescaler < 9 && (16L << (prescaler + 1)) <= wait)
+    {
+        prescaler++;
+    }
+
+    watchdogWoke = false;
+    noInterrupts();
+    wdt_reset();
+    MCUSR &= ~_BV(WDRF);
+    WDTCSR = _BV(WDCE) | _BV(WDE);
+    WDTCSR = _BV(WDIE) | (prescaler & 0x07) | (prescaler & 0x08 ? _BV(WDP3) : 0);
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    sleep_enable();
+    interrupts();
+    sleep_cpu();
+    sleep_disable();
+    startWatchdog();
+
+    if (watchdogWoke)
+    {
+        noInterrupts();
+        timer0_millis += 16UL << prescaler;
+        interrupts();
+    }
+
+    now = millis();
+    for (Task &task : tasks)
+    {
+        if (task.polled)
+        {
+            task.nextRun = now;
+        }
+    }
+}
+
+/**
+ * @brief Starts the watchdog as the supervisor of the tasks.
+ *
+ * It runs in interrupt and reset mode and times out unless loop() resets it, so its interrupt comes
+ * once a single task has run for 16 ms << WATCHDOG_PRESCALER.
+ */
+void startWatchdog()
+{
+    noInterrupts();
+    wdt_reset();
+    MCUSR &= ~_BV(WDRF);
+    WDTCSR = _BV(WDCE) | _BV(WDE);
+    WDTCSR = _BV(WDIE) | _BV(WDE) | (WATCHDOG_PRESCALER & 0x07) | (WATCHDOG_PRESCALER & 0x08 ? _BV(WDP3) : 0);
+    interrupts();
+}
+
+/**
+ * @brief Keeps the reset cause and turns the watchdog off before the C runtime starts.
+ *
+ * After a watchdog reset it stays on with its shortest timeout, and would reset the chip again long before setup().
+ * Optiboot clears MCUSR before starting the sketch, so resetFlags may be 0 and the records are checked on their own too.
+ */
+void disableWatchdogAtBoot() __attribute__((naked, used, section(".init3")));
+void disableWatchdogAtBoot()
+{
+    resetFlags = MCUSR;
+    MCUSR = 0;
+    wdt_disable();
+}
+
+/**
+ * @brief Watchdog interrupt, the wake-up from power-down or the supervisor catching a task that hangs.
+ *
+ * Only the supervisor sets WDE. Then the task is recorded for setup() to warm-boot from the snapshot, and the
+ * watchdog is switched to a plain reset after 16 ms, instead of waiting out another timeout.
+ */
+ISR(WDT_vect)
+{
+    if (!(WDTCSR & _BV(WDE)))
+    {
+        watchdogWoke = true;
+        return;
+    }
+
+    watchdogStall.magic = WARM_BOOT_MAGIC;
+    watchdogStall.time = millis();
+    watchdogStall.task = runningTask;
+    watchdogStall.check = ~runningTask;
+    WDTCSR = _BV(WDCE) | _BV(WDE);
+    WDTCSR = _BV(WDE);
+    while (true)
+    {
+    }
+}
+
+/**
+ * @brief Takes a snapshot of the profiles, filters, fills and totals of the tanks for a warm boot.
+ *
+ * Run as a task, so it never catches the filters halfway through a sample.
+ */
+void saveWarmBoot()
+{
+    warmBoot.magic = WARM_BOOT_MAGIC;
+    warmBoot.currentTank = currentTank;
+    warmBoot.watchdogResets = stats.watchdogResets;
+    for (uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        const Tank &tank = tanks[i];
+        WarmTank &saved = warmBoot.tanks[i];
+        saved.profile = tank.profile;
+        memcpy(saved.medianWindow, tank.medianWindow, sizeof(saved.medianWindow));
+        saved.medianNext = tank.medianNext;
+        saved.medianCount = tank.medianCount;
+        saved.estimate = tank.estimate;
+        saved.session = tank.session;
+        saved.totals = tank.totals;
+        saved.totalsDirty = tank.totalsDirty;
+        saved.totalsChanged = tank.totalsChanged;
+    }
+    warmBoot.crc = crc16((const uint8_t *)&warmBoot, offsetof(WarmBoot, crc));
+}
+
+/**
+ * @brief Checks whether the snapshot survived the reset.
+ *
+ * @return True if it holds a complete snapshot.
+ */
+bool validWarmBoot()
+{
+    return warmBoot.magic == WARM_BOOT_MAGIC && warmBoot.currentTank < TANK_COUNT &&
+           warmBoot.crc == crc16((const uint8_t *)&warmBoot, offsetof(WarmBoot, crc));
+}
+
+/**
+ * @brief Carries on from the snapshot after a watchdog reset, with the profiles of the tanks already loaded.
+ *
+ * millis() is set to where it was when the task hung, plus the reset, so the times in the filters, fills and totals
+ * stay right. The next ping then continues the level estimates, and unsaved totals are still saved.
+ * The display comes back on, as after any boot.
+ */
+void restoreWarmBoot()
+{
+    noInterrupts();
+    timer0_millis += watchdogStall.time + 16;
+    interrupts();
+
+    currentTank = warmBoot.currentTank;
+    for (uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        Tank &tank = tanks[i];
+        const WarmTank &saved = warmBoot.tanks[i];
+        memcpy(tank.medianWindow, saved.medianWindow, sizeof(tank.medianWindow));
+        tank.medianNext = saved.medianNext;
+        tank.medianCount = saved.medianCount;
+        tank.estimate = saved.estimate;
+        tank.session = saved.session;
+        tank.totals = saved.totals;
+        tank.totalsDirty = saved.totalsDirty;
+        tank.totalsChanged = saved.totalsChanged;
+    }
+    lastInputTime = millis();
+}
+
+/**
+ * @brief Adds a run of a section to its timing.
+ *
+ * Timer1 wraps every 262 ms, which no section comes close to, so the unsigned difference is the run time.
+ *
+ * @param section The TIMING_* section.
+ * @param started TCNT1 when the run started.
+ */
+void addTiming(uint8_t section, uint16_t started)
+{
+    uint16_t ticks = TCNT1 - started;
+    SectionTiming &timing = timings[section];
+    if (timing.count == 0 || ticks < timing.minimum)
+    {
+        timing.minimum = ticks;
+    }
+    timing.maximum = max(timing.maximum, ticks);
+    timing.total += ticks;
+    timing.count++;
+    if (timing.count == 0xFFFF)
+    {
+        // Halve the runs so the mean keeps moving instead of the counters wrapping
+        timing.total /= 2;
+        timing.count /= 2;
+    }
+}
+
+/**
+ * @brief Fills the free SRAM between the heap and the stack with STACK_PAINT.
+ *
+ * Called once at boot, so freeStackLowWater() can later count the bytes the stack never reached.
+ */
+void paintStack()
+{
+    extern uint8_t __heap_start;
+    extern uint8_t *__brkval;
+    uint8_t *p = __brkval ? __brkval : &__heap_start;
+    uint8_t *end = reinterpret_cast<uint8_t *>(SP) - 16; // stay clear of this call's own frame
+    while (p < end)
+    {
+        *p++ = STACK_PAINT;
+    }
+}
+
+/**
+ * @brief Returns the least free SRAM there has been since boot.
+ *
+ * @return The bytes above the heap that the stack has never written to.
+ */
+uint16_t freeStackLowWater()
+{
+    extern uint8_t __heap_start;
+    extern uint8_t *__brkval;
+    const uint8_t *p = __brkval ? __brkval : &__heap_start;
+    const uint8_t *end = reinterpret_cast<const uint8_t *>(SP);
+    uint16_t count = 0;
+    while (p < end && *p == STACK_PAINT)
+    {
+        p++;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Slows the pings down while every level is stable, and speeds them up again as soon as one changes.
+ *
+ * A level that is lost counts as stable, its tank already backs off by itself.
+ */
+void updatePingRate()
+{
+    unsigned long now = millis();
+    for (const Tank &tank : tanks)
+    {
+        if (tank.estimate.valid && abs(tank.estimate.rate) >= LEVEL_STABLE_RATE)
+        {
+            stableSince = now;
+        }
+    }
+
+    unsigned long period = now - stableSince >= LEVEL_STABLE_TIME ? SLOW_PING_INTERVAL : PING_INTERVAL;
+    for (Task &task : tasks)
+    {
+        if (task.run == updateSonar)
+        {
+            task.period = period;
+        }
+    }
+}
+
+/**
+ * @brief Filters the result of the previous sonar ping and starts a new one in the background.
+ *
+ * The echo is timed by NewPing's timer interrupt and delivered to echoCheck().
+ * If the previous ping never reported an echo, a NO_ECHO sample is recorded for it
+ * before the next one is triggered, matching what ping_cm() used to return.
+ * With several tanks each run pings the next one, so only one sensor is ever listening and each
+ * is pinged every TANK_COUNT * PING_INTERVAL ms; the estimator works from the sample times, not their rate.
+ * A tank whose echoes are invalid is skipped for a growing number of runs, up to PING_MAX_BACKOFF,
+ * so foam or a missing target is not hammered every interval. Each ping only listens out to the tank's
+ * maxDistance, or the full range while the level is lost. While every level is stable the pings slow down
+ * to SLOW_PING_INTERVAL.
+ */
+void updateSonar()
+{
+    noInterrupts();
+    if (pingPending)
+    {
+        NewPing::timer_stop();
+        pushSonarSample(pingTank, NO_ECHO);
+        pingPending = false;
+        stats.pingTimeouts++;
+    }
+    interrupts();
+
+    updateLevelEstimate(pingStartTime);
+    updatePingRate();
+
+    uint8_t next = NO_TANK;
+    for (uint8_t i = 1; i <= TANK_COUNT; i++)
+    {
+        uint8_t index = (pingTank + i) % TANK_COUNT;
+        Tank &tank = tanks[index];
+        if (tank.holdoff > 0)
+        {
+            tank.holdoff--;
+        }
+        else if (next == NO_TANK)
+        {
+            next = index;
+        }
+    }
+    if (next == NO_TANK)
+    {
+        return;
+    }
+
+    const Tank &tank = tanks[next];
+    noInterrupts();
+    pingTank = next;
+    pingPending = true;
+    interrupts();
+
+    pingStartTime = millis();
+    sonars[next].ping_timer(echoCheck, tank.searching ? MAX_SENSOR_DISTANCE : tank.maxDistance);
+}
+
+/**
+ * @brief Timer interrupt callback that collects the echo of a background ping.
+ *
+ * NewPing calls this every 24 microseconds while a ping is in flight.
+ * Once the echo has arrived the raw echo time is written into the sample ring buffer.
+ * It is only converted to a distance later, so no resolution is lost to whole centimetres.
+ */
+void echoCheck()
+{
+    NewPing &sonar = sonars[pingTank];
+    if (sonar.check_timer())
+    {
+        pushSonarSample(pingTank, sonar.ping_result);
+        pingPending = false;
+    }
+}
+
+/**
+ * @brief Writes an echo time into the sample ring buffer, overwriting the oldest one.
+ *
+ * @param tank The index of the tank the echo is of.
+ * @param echoTime The round-trip echo time in microseconds, or NO_ECHO.
+ * @note Must be called from the echo interrupt or with interrupts disabled.
+ */
+void pushSonarSample(uint8_t tank, uint16_t echoTime)
+{
+    sonarBuffer[sonarHead % SONAR_BUFFER_SIZE] = echoTime;
+    sonarTanks[sonarHead % SONAR_BUFFER_SIZE] = tank;
+    sonarHead++;
+    checkCutoff(tanks[tank], echoTime);
+}
+
+/**
+ * @brief Switches the fill cutoff output on a new echo.
+ *
+ * Compares the raw echo time with the thresholds precomputed by updateCutoffThreshold(), so the decision
+ * takes a few microseconds and the output follows the ping, not the filter or the display.
+ * CUTOFF_CONFIRM echoes in a row have to agree before the output switches, to ride out a stray echo from foam,
+ * and the release threshold lies CUTOFF_HYSTERESIS below the target so the valve does not chatter.
+ * Without a target, or after CUTOFF_MAX_MISSES pings without a valid echo, filling is stopped.
+ *
+ * @param tank The tank the echo is of.
+ * @param echoTime The round-trip echo time in microseconds, or NO_ECHO.
+ * @note Must be called from the echo interrupt or with interrupts disabled.
+ */
+void checkCutoff(Tank &tank, uint16_t echoTime)
+{
+    bool cutoff = tank.fillCutoff;
+
+    // An echo from beyond the bottom counts as missing even while searching, never as a vote to fill
+    if (echoTime == NO_ECHO || echoTime < tank.minEchoTime || echoTime > tank.rangeEchoTime)
+    {
+        if (tank.missedEchoes < CUTOFF_MAX_MISSES)
+        {
+            tank.missedEchoes++;
+        }
+    }
+    else
+    {
+        tank.missedEchoes = 0;
+        bool disagrees = cutoff ? echoTime >= tank.releaseEchoTime : echoTime <= tank.cutoffEchoTime;
+        tank.cutoffVotes = disagrees ? tank.cutoffVotes + 1 : 0;
+        if (tank.cutoffVotes >= CUTOFF_CONFIRM)
+        {
+            cutoff = !cutoff;
+            tank.cutoffVotes = 0;
+        }
+    }
+
+    if (tank.cutoffEchoTime == 0 || tank.missedEchoes >= CUTOFF_MAX_MISSES)
+    {
+        cutoff = true;
+    }
+
+    tank.fillCutoff = cutoff;
+    if (cutoff)
+    {
+        *tank.cutoffPort &= ~tank.cutoffMask;
+    }
+    else
+    {
+        *tank.cutoffPort |= tank.cutoffMask;
+    }
+}
+
+/**
+ * @brief Feeds the sonar samples that completed since the last call into the level estimator.
+ *
+ * If more samples arrived than the ring buffer holds, the overwritten ones are skipped.
+ * Every sample goes to its own tank's estimator, the fill history only follows the tank shown.
+ *
+ * @param sampleTime The time in milliseconds the ping of the pending samples was started.
+ */
+void updateLevelEstimate(unsigned long sampleTime)
+{
+    uint8_t head = sonarHead;
+    if ((uint8_t)(head - estimatorTail) > SONAR_BUFFER_SIZE)
+    {
+        estimatorTail = head - SONAR_BUFFER_SIZE;
+    }
+
+    while (estimatorTail != head)
+    {
+        uint16_t echoTime = sonarBuffer[estimatorTail % SONAR_BUFFER_SIZE];
+        uint8_t tank = sonarTanks[estimatorTail % SONAR_BUFFER_SIZE];
+        estimatorTail++;
+        bool valid = addLevelSample(tanks[tank], echoTime, sampleTime);
+        sendTelemetry(tank, echoTime, valid, sampleTime);
+        if (tank == currentTank)
+        {
+            logSample(sampleTime);
+        }
+    }
+}
+
+/**
+ * @brief Runs one sample through the median filter and the alpha-beta filter.
+ *
+ * The median over the last LEVEL_MEDIAN_WINDOW echo times rejects single-ping outliers from foam and CO2.
+ * It is converted to a distance with the current speed of sound, then the alpha-beta filter smooths it
+ * and tracks the rate at which the distance changes.
+ * All arithmetic is fixed-point and the buffers are static, so this is cheap enough for every ping.
+ * Missing and out-of-range echoes never reach the filters; after ECHO_LOST_COUNT of them in a row
+ * the level is lost, the estimate invalid, and the sensor searches its whole range until it finds it again.
+ *
+ * @param tank The tank the sample is of.
+ * @param echoTime The round-trip echo time in microseconds, or NO_ECHO.
+ * @param time The time in milliseconds the sample was taken.
+ * @return False if the echo was invalid and left out of the filters.
+ */
+bool addLevelSample(Tank &tank, uint16_t echoTime, unsigned long time)
+{
+    if (!validEcho(tank, echoTime))
+    {
+        tank.holdoff = tank.backoff;
+        tank.backoff = constrain(tank.backoff * 2, 1, PING_MAX_BACKOFF);
+        if (tank.invalidEchoes < ECHO_LOST_COUNT && ++tank.invalidEchoes == ECHO_LOST_COUNT)
+        {
+            tank.searching = true;
+            tank.estimate.valid = false;
+            tank.medianCount = 0;
+            tank.medianNext = 0;
+            updateFillPrediction(tank);
+        }
+        return false;
+    }
+    tank.invalidEchoes = 0;
+    tank.backoff = 0;
+    tank.searching = false;
+
+    tank.medianWindow[tank.medianNext] = echoTime;
+    tank.medianNext = (tank.medianNext + 1) % LEVEL_MEDIAN_WINDOW;
+    if (tank.medianCount < LEVEL_MEDIAN_WINDOW)
+    {
+        tank.medianCount++;
+    }
+
+    LevelEstimate &levelEstimate = tank.estimate;
+    int32_t measured = ((uint32_t)medianEchoTime(tank) * tank.echoMmPerUs) >> 8; // mm in Q8
+    addCalibrationPing(tank, measured);
+
+    if (!levelEstimate.valid)
+    {
+        levelEstimate.distance = measured;
+        levelEstimate.rate = 0;
+        levelEstimate.time = time;
+        levelEstimate.valid = true;
+        return true;
+    }
+
+    int32_t dt = time - levelEstimate.time;
+    if (dt <= 0)
+    {
+        dt = 1;
+    }
+    levelEstimate.time = time;
+
+    int32_t predicted = levelEstimate.distance + levelEstimate.rate * dt / 1000;
+    int32_t residual = constrain(measured - predicted, -LEVEL_MAX_RESIDUAL, LEVEL_MAX_RESIDUAL);
+
+    levelEstimate.distance = predicted + ((residual * LEVEL_ALPHA) >> 8);
+    // Scaled to per second before the shift, so its rounding does not bias the rate by 1000 / dt Q8 units
+    levelEstimate.rate += (residual * LEVEL_BETA * 1000 / dt) >> 8;
+
+    updateFillPrediction(tank);
+    updateSession(tank, time);
+    return true;
+}
+
+/**
+ * @brief Follows fills and draw-offs of a tank from the rate of its filtered level.
+ *
+ * A fill or a draw-off starts once the volume has kept rising or falling faster than MIN_FILL_RATE for
+ * SESSION_START_TIME and by SESSION_MIN_VOLUME, and counts from where the level started to move; a drift that
+ * moves it less within SESSION_START_TIME is watched again from where it got to. It ends where the level stopped,
+ * once it has held still for SESSION_STOP_TIME, or at once where it turned around. Small changes from foam
+ * or a settling surface stay below SESSION_MIN_VOLUME and are dropped.
+ *
+ * @param tank The tank, with its fill prediction just updated.
+ * @param time The time in milliseconds the sample was taken.
+ */
+void updateSession(Tank &tank, unsigned long time)
+{
+    if (!tank.geometry.configured)
+    {
+        return;
+    }
+    BatchSession &session = tank.session;
+
+    int32_t rate = tank.prediction.rate;
+    uint8_t direction = rate >= MIN_FILL_RATE ? SESSION_FILL : rate <= -MIN_FILL_RATE ? SESSION_DRAW : SESSION_IDLE;
+    if (direction != session.direction)
+    {
+        session.direction = direction;
+        session.since = time;
+        session.sinceVolume = currentVolume(tank);
+    }
+    unsigned long held = time - session.since;
+
+    if (session.state == SESSION_IDLE)
+    {
+        uint32_t volume = currentVolume(tank);
+        uint32_t moved = volume > session.sinceVolume ? volume - session.sinceVolume : session.sinceVolume - volume;
+        if (direction != SESSION_IDLE && held >= SESSION_START_TIME)
+        {
+            if (moved >= SESSION_MIN_VOLUME)
+            {
+                session.state = direction;
+                session.startTime = session.since;
+                session.startVolume = session.sinceVolume;
+                uint16_t secondsToTarget = tank.prediction.secondsToTarget;
+                session.expected = direction == SESSION_FILL && secondsToTarget != ETA_UNKNOWN ?
+                                   min(held / 1000 + secondsToTarget, 65535UL) : 0;
+            }
+            else
+            {
+                // Only drifting, as the filter's rate rings a while after the level stops, so start over from here
+                session.since = time;
+                session.sinceVolume = volume;
+            }
+        }
+    }
+    else if (direction != session.state && (direction != SESSION_IDLE || held >= SESSION_STOP_TIME))
+    {
+        endSession(tank, session.since, session.sinceVolume);
+    }
+}
+
+/**
+ * @brief Ends the fill or draw-off of a tank, adding it to the totals of its profile and to the event log.
+ *
+ * The totals are saved after TOTALS_SAVE_DELAY, together with whatever else changed them meanwhile.
+ * The event has how long a fill took against the time to the target predicted when it was detected,
+ * so a pump that slowed down shows as over 100 %.
+ *
+ * @param tank The tank.
+ * @param time The time in milliseconds the level stopped or turned.
+ * @param volume The volume in mL then.
+ */
+void endSession(Tank &tank, unsigned long time, uint32_t volume)
+{
+    BatchSession &session = tank.session;
+    int32_t change = (int32_t)(volume - session.startVolume);
+    uint8_t state = session.state;
+    session.state = SESSION_IDLE;
+    if (abs(change) < SESSION_MIN_VOLUME || (state == SESSION_FILL) != (change > 0))
+    {
+        return;
+    }
+
+    BatchTotals &totals = tank.totals;
+    if (state == SESSION_FILL)
+    {
+        totals.filled += change;
+        totals.fills++;
+    }
+    else
+    {
+        totals.drawn -= change;
+        totals.draws++;
+    }
+    if (!tank.totalsDirty)
+    {
+        tank.totalsDirty = true;
+        tank.totalsChanged = millis();
+    }
+
+    FillEvent &event = fillEvents[fillEventCount % EVENT_LOG_SIZE];
+    fillEventCount++;
+    event.time = time / 1000;
+    event.volume = constrain((change + (change < 0 ? -500 : 500)) / 1000, -32768L, 32767L);
+    event.duration = min((time - session.startTime) / 1000, 65535UL);
+    event.tank = &tank - tanks;
+    event.profile = tank.profile;
+    event.target = session.expected ? min((uint32_t)event.duration * 100 / session.expected, 255UL) : 0;
+}
+
+/**
+ * @brief Checks whether an echo can be the surface of the tank.
+ *
+ * @param tank The tank the echo is of.
+ * @param echoTime The round-trip echo time in microseconds, or NO_ECHO.
+ * @return True if there was an echo, not from the ringing of the transducer, and not from beyond the bottom.
+ *         Searching only widens how far the sensor listens, an echo from past the bottom never reaches the filters.
+ */
+bool validEcho(const Tank &tank, uint16_t echoTime)
+{
+    return echoTime != NO_ECHO && echoTime >= tank.minEchoTime && echoTime <= tank.rangeEchoTime;
+}
+
+/**
+ * @brief Predicts the fill rate and the time to the target volume from the level estimate.
+ *
+ * The rate of the surface is turned into a volume rate with the slope of the height to volume table at the
+ * current height. The table segment is kept from the previous sample and walked from there, since the level
+ * moves at most a segment between pings, so this is O(1) per sample like the filters before it.
+ * The alarm is raised once the remaining volume would be filled within alarmLead seconds, and dropped
+ * when filling stops or slows to half that, so it warns ahead of the target instead of after it.
+ * ALARM_PIN is shared, so it is driven while the alarm of any tank is raised.
+ *
+ * @param tank The tank whose level estimate changed.
+ */
+void updateFillPrediction(Tank &tank)
+{
+    FillPrediction &prediction = tank.prediction;
+    const TankGeometry &tankGeometry = tank.geometry;
+    const GeometryTable &table = tankGeometry.table;
+    uint16_t distance = filteredDistance(tank);
+    uint16_t minHeight = tank.setting.minHeight;
+
+    if (!tankGeometry.configured || !tank.estimate.valid)
+    {
+        prediction.rate = 0;
+        prediction.remaining = 0;
+        prediction.secondsToTarget = ETA_UNKNOWN;
+        prediction.alarm = false;
+        updateAlarmOutput();
+        return;
+    }
+
+    uint16_t height = distance < minHeight ? minHeight - distance : 0;
+    uint8_t segment = min(prediction.segment, (uint8_t)(table.count - 2));
+    while (segment > 0 && height < table.points[segment].height)
+    {
+        segment--;
+    }
+    while (segment + 2 < table.count && height >= table.points[segment + 1].height)
+    {
+        segment++;
+    }
+    prediction.segment = segment;
+
+    const GeometryPoint &from = table.points[segment];
+    const GeometryPoint &to = table.points[segment + 1];
+    int32_t slope = ((to.volume - from.volume) << 4) / (to.height - from.height); // mL per mm in Q4
+
+    // The distance shrinks while filling; Q8 mm/s >> 4 times Q4 mL/mm is mL/s in Q8
+    prediction.rate = ((-tank.estimate.rate >> 4) * slope) >> 8;
+
+    uint32_t volume = segmentVolume(table, segment, height);
+    prediction.remaining = volume < tankGeometry.targetVolume ? tankGeometry.targetVolume - volume : 0;
+
+    uint32_t leadVolume = 0;
+    prediction.secondsToTarget = ETA_UNKNOWN;
+    if (prediction.rate >= MIN_FILL_RATE)
+    {
+        leadVolume = (uint32_t)prediction.rate * alarmLead;
+        prediction.secondsToTarget = min(prediction.remaining / prediction.rate, (uint32_t)ETA_UNKNOWN - 1);
+    }
+
+    if (prediction.remaining <= leadVolume)
+    {
+        prediction.alarm = true;
+    }
+    else if (prediction.remaining > 2 * leadVolume)
+    {
+        prediction.alarm = false;
+    }
+    updateAlarmOutput();
+}
+
+/**
+ * @brief Drives ALARM_PIN high while the fill alarm of any tank is raised.
+ */
+void updateAlarmOutput()
+{
+#ifdef ALARM_PIN
+    bool alarm = false;
+    for (const Tank &tank : tanks)
+    {
+        alarm |= tank.prediction.alarm;
+    }
+    digitalWrite(ALARM_PIN, alarm ? HIGH : LOW);
+#endif
+}
+
+/**
+ * @brief Returns the median of the samples in the median window.
+ *
+ * The window is small, so an insertion sort of a copy is the cheapest way to find it.
+ *
+ * @param tank The tank.
+ * @return The median echo time in microseconds.
+ */
+uint16_t medianEchoTime(const Tank &tank)
+{
+    uint8_t medianCount = tank.medianCount;
+    uint16_t sorted[LEVEL_MEDIAN_WINDOW];
+    for (uint8_t i = 0; i < medianCount; i++)
+    {
+        uint16_t value = tank.medianWindow[i];
+        uint8_t j = i;
+        while (j > 0 && sorted[j - 1] > value)
+        {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = value;
+    }
+    return sorted[medianCount / 2];
+}
+
+/**
+ * @brief Updates the speed of sound used to convert echo times to distances.
+ *
+ * The temperature comes from the TMP36 on TEMP_SENSOR_PIN if one is fitted, the same for every tank,
+ * otherwise from the temperature configured in the profile of each tank.
+ * Sound travels 0.606 m/s faster per degree, so without this a 10 degree swing would be a 1.8% range error.
+ */
+void updateTemperature()
+{
+#ifdef TEMP_SENSOR_PIN
+    // TMP36: 10 mV per degree with a 500 mV offset, so the reading in mV minus 500 is tenths of a degree
+    airTemperature = (int32_t)analogRead(TEMP_SENSOR_PIN) * 5000 / 1024 - 500;
+#endif
+
+    for (uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        Tank &tank = tanks[i];
+        int16_t temperature = airTemperature;
+#ifndef TEMP_SENSOR_PIN
+        temperature = tank.setting.temperature * 10;
+        if (i == currentTank)
+        {
+            airTemperature = temperature;
+        }
+#endif
+
+        int32_t speed = 331300L + 606L * temperature / 10; // mm/s
+        tank.echoMmPerUs = speed * 4096 / 125000;          // speed / 2 (round trip) / 1e6 in Q16
+
+        updateEchoRange(tank);
+        updateCutoffThreshold(tank);
+    }
+}
+
+/**
+ * @brief Precomputes the echo times at which the fill cutoff switches.
+ *
+ * The target volume is turned into a distance from the sensor with the height to volume table,
+ * and that distance into an echo time with the current speed of sound, so the echo interrupt only compares.
+ * Called whenever the geometry or the speed of sound changes.
+ *
+ * @param tank The tank.
+ */
+void updateCutoffThreshold(Tank &tank)
+{
+    uint16_t cutoff = 0;
+    uint16_t release = 0;
+
+    const TankGeometry &tankGeometry = tank.geometry;
+    uint16_t minHeight = tank.setting.minHeight;
+    if (tankGeometry.configured && tank.echoMmPerUs > 0)
+    {
+        uint16_t height = tableHeight(tankGeometry.table, tankGeometry.targetVolume);
+        if (height < minHeight)
+        {
+            uint32_t distance = minHeight - height;
+            cutoff = (distance << 16) / tank.echoMmPerUs;
+            release = ((distance + CUTOFF_HYSTERESIS) << 16) / tank.echoMmPerUs;
+        }
+    }
+
+    noInterrupts();
+    tank.cutoffEchoTime = cutoff;
+    tank.releaseEchoTime = release;
+    interrupts();
+}
+
+/**
+ * @brief Precomputes the range of echo times that can come from the surface of a tank.
+ *
+ * The sensor listens out to SONAR_RANGE_MARGIN beyond the bottom, rather than NewPing's full range,
+ * so a ping that gets no echo times out after a few ms instead of holding the echo timer for the whole interval.
+ * A tank that is not set up yet has no bottom, and gets the full range.
+ * Called whenever the geometry or the speed of sound changes.
+ *
+ * @param tank The tank.
+ */
+void updateEchoRange(Tank &tank)
+{
+    uint32_t range = (uint32_t)MAX_SENSOR_DISTANCE * 10; // mm
+    if (tank.setting.minHeight > 0)
+    {
+        range = min((uint32_t)tank.setting.minHeight + SONAR_RANGE_MARGIN, range);
+    }
+    tank.maxDistance = (range + 9) / 10;
+
+    uint16_t minimum = 1;
+    uint16_t maximum = 0xFFFF;
+    if (tank.echoMmPerUs > 0)
+    {
+        minimum = ((uint32_t)SONAR_MIN_DISTANCE << 16) / tank.echoMmPerUs;
+        maximum = min((range << 16) / tank.echoMmPerUs, (uint32_t)0xFFFF);
+    }
+
+    noInterrupts();
+    tank.minEchoTime = minimum;
+    tank.rangeEchoTime = maximum;
+    interrupts();
+}
+
+/**
+ * @brief Returns the filtered distance from the sensor to the surface.
+ *
+ * @param tank The tank.
+ * @return The filtered distance in mm, or NO_ECHO if nothing has been measured yet.
+ */
+uint16_t filteredDistance(const Tank &tank)
+{
+    if (!tank.estimate.valid || tank.estimate.distance < 0)
+    {
+        return NO_ECHO;
+    }
+    return tank.estimate.distance >> 8;
+}
+
+/**
+ * @brief Returns the current volume of the tank from the filtered distance.
+ *
+ * The volume is looked up in the height to volume table built by updateTankGeometry(),
+ * so the cost is O(log n) whatever the shape of the tank.
+ *
+ * @param tank The tank.
+ * @return The volume in mL, 0 if the tank is not set up, the level is lost or the surface is below the bottom.
+ */
+uint32_t currentVolume(const Tank &tank)
+{
+    uint16_t distance = filteredDistance(tank);
+    uint16_t minHeight = tank.setting.minHeight;
+    if (!tank.geometry.configured || distance == NO_ECHO || distance >= minHeight)
+    {
+        return 0;
+    }
+    return tableVolume(tank.geometry.table, minHeight - distance);
+}
+
+/**
+ * @brief Looks up the volume at a height in a height to volume table.
+ *
+ * The segment is found by binary search and the volume interpolated linearly between its two points.
+ * Above the last point the last segment is extended.
+ *
+ * @param table The table, with at least two points.
+ * @param height The height above the bottom of the tank in mm.
+ * @return The volume in mL.
+ */
+uint32_t tableVolume(const GeometryTable &table, uint16_t height)
+{
+    uint8_t low = 0;
+    uint8_t high = table.count - 1;
+    while (high - low > 1)
+    {
+        uint8_t middle = (low + high) / 2;
+        if (table.points[middle].height <= height)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return segmentVolume(table, low, height);
+}
+
+/**
+ * @brief Looks up the height at which a height to volume table reaches a volume.
+ *
+ * The inverse of tableVolume(), used for thresholds rather than per sample.
+ *
+ * @param table The table, with at least two points.
+ * @param volume The volume in mL.
+ * @return The height above the bottom of the tank in mm.
+ */
+uint16_t tableHeight(const GeometryTable &table, uint32_t volume)
+{
+    uint8_t low = 0;
+    uint8_t high = table.count - 1;
+    while (high - low > 1)
+    {
+        uint8_t middle = (low + high) / 2;
+        if (table.points[middle].volume <= volume)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    const GeometryPoint &from = table.points[low];
+    const GeometryPoint &to = table.points[high];
+    uint32_t slope = ((to.volume - from.volume) << 4) / (to.height - from.height); // mL per mm in Q4
+    if (volume <= from.volume || slope == 0)
+    {
+        return from.height;
+    }
+    return min(from.height + ((volume - from.volume) << 4) / slope, 65535UL);
+}
+
+/**
+ * @brief Interpolates the volume at a height within one segment of a height to volume table.
+ *
+ * @param table The table, with at least two points.
+ * @param segment The index of the segment's first point.
+ * @param height The height above the bottom of the tank in mm, at least the segment's first height.
+ * @return The volume in mL.
+ */
+uint32_t segmentVolume(const GeometryTable &table, uint8_t segment, uint16_t height)
+{
+    const GeometryPoint &from = table.points[segment];
+    const GeometryPoint &to = table.points[segment + 1];
+    uint16_t span = to.height - from.height;
+    uint32_t rise = to.volume - from.volume;
+    uint16_t offset = height - from.height;
+
+    // rise * offset can overflow 32 bits on a big tank, so the quotient and remainder are scaled separately
+    return from.volume + (rise / span) * offset + (rise % span) * offset / span;
+}
+
+/**
+ * @brief Returns the cross-section of a frustum slice.
+ *
+ * A slice with diameters d0 and d1 holds pi / 12 * (d0^2 + d0 * d1 + d1^2) per mm of height,
+ * which for d0 = d1 is the cylinder's pi / 4 * d^2.
+ *
+ * @param bottom The diameter at the bottom of the slice in mm.
+ * @param top The diameter at the top of the slice in mm.
+ * @return The volume per mm of height, mL in Q4.
+ */
+uint32_t crossSection(uint16_t bottom, uint16_t top)
+{
+    uint32_t meanSquare = ((uint32_t)bottom * bottom + (uint32_t)bottom * top + (uint32_t)top * top) / 3;
+
+    // pi / 4 / 1000 mL per mm^3 in Q4 is 0.0125664, or 0.80425 after dropping 6 bits of d^2 to stay within 32 bits
+    return (meanSquare >> 6) * 8042 / 10000;
+}
+
+/**
+ * @brief Builds the height to volume table of a cylinder or a tapered tank.
+ *
+ * The tapered section is split into evenly spaced frustum slices whose volumes are exact,
+ * and the cylinder above it needs just one more point, since its volume is linear in height.
+ * A cylinder is the same thing with no tapered section.
+ *
+ * @param setting The setting describing the tank.
+ * @param table The table to fill.
+ */
+void buildGeometryTable(const MakgeolliTankSetting &setting, GeometryTable &table)
+{
+    uint16_t top = setting.minHeight;
+    uint16_t taper = setting.shape == SHAPE_TAPERED ? min(setting.taperHeight, top) : 0;
+    uint8_t slices = taper > 0 ? GEOMETRY_TABLE_SIZE - 2 : 0;
+
+    table.points[0].height = 0;
+    table.points[0].volume = 0;
+    table.count = 1;
+
+    uint16_t previousHeight = 0;
+    uint16_t previousDiameter = setting.bottomDiameter;
+    uint32_t volume = 0;
+    for (uint8_t i = 1; i <= slices; i++)
+    {
+        uint16_t height = (uint32_t)taper * i / slices;
+        uint16_t diameter = setting.bottomDiameter + ((int32_t)setting.diameter - setting.bottomDiameter) * height / taper;
+        volume += (crossSection(previousDiameter, diameter) * (height - previousHeight)) >> 4;
+
+        table.points[table.count].height = height;
+        table.points[table.count].volume = volume;
+        table.count++;
+        previousHeight = height;
+        previousDiameter = diameter;
+    }
+
+    if (top > taper)
+    {
+        volume += (crossSection(setting.diameter, setting.diameter) * (top - taper)) >> 4;
+        table.points[table.count].height = top;
+        table.points[table.count].volume = volume;
+        table.count++;
+    }
+}
+
+/**
+ * @brief Reads the stored height to volume table of a profile from the EEPROM memory.
+ *
+ * @param index The profile index.
+ * @param table The table to fill.
+ * @return True if a valid table was stored: at least two points, heights increasing and volumes not decreasing.
+ */
+bool loadGeometryTable(int index, GeometryTable &table)
+{
+    EEPROM.get(GEOMETRY_TABLE_ADDRESS + index * sizeof(GeometryTable), table);
+    if (table.count < 2 || table.count > GEOMETRY_TABLE_SIZE)
+    {
+        return false;
+    }
+    for (uint8_t i = 1; i < table.count; i++)
+    {
+        if (table.points[i].height <= table.points[i - 1].height || table.points[i].volume < table.points[i - 1].volume)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Precomputes the geometry of a tank's setting.
+ *
+ * Called whenever the setting is loaded, switched or edited, so the per-frame volume math is just a table
+ * lookup, with no floating-point or PI. Cylinders and tapered tanks get a table built from their dimensions,
+ * table-shaped tanks use the one stored in the EEPROM memory for their profile.
+ *
+ * @param tank The tank.
+ */
+void updateTankGeometry(Tank &tank)
+{
+    const MakgeolliTankSetting &setting = tank.setting;
+    TankGeometry &tankGeometry = tank.geometry;
+
+    tankGeometry.targetVolume = (uint32_t)setting.targetCapacity * 1000;
+    if (setting.shape == SHAPE_TABLE)
+    {
+        tankGeometry.configured = setting.minHeight > 0 && tank.profile < GEOMETRY_TABLE_COUNT &&
+                                  loadGeometryTable(tank.profile, tankGeometry.table);
+    }
+    else
+    {
+        tankGeometry.configured = setting.minHeight > 0 && setting.diameter > 0;
+        buildGeometryTable(setting, tankGeometry.table);
+    }
+    updateEchoRange(tank);
+    updateCutoffThreshold(tank);
+}
+
+/**
+ * @brief Precomputes the geometry of the tank shown, after its setting was edited.
+ */
+void updateCurrentGeometry()
+{
+    updateTankGeometry(tanks[currentTank]);
+}
+
+/**
+ * @brief Reads the current level of all buttons straight from the port.
+ *
+ * All button pins are on PORTD (digital pins 0-7), so a single read of PIND samples them together.
+ * This is cheap enough to call from the pin change interrupt.
+ *
+ * @return A bit mask of the pressed buttons (BUTTON_UP, BUTTON_DOWN, ...).
+ */
+uint8_t readButtons()
+{
+    uint8_t port = ~PIND;
+    uint8_t buttons = 0;
+    if (port & _BV(BUTTON_UP_PIN))
+        buttons |= BUTTON_UP;
+    if (port & _BV(BUTTON_DOWN_PIN))
+        buttons |= BUTTON_DOWN;
+    if (port & _BV(BUTTON_LEFT_PIN))
+        buttons |= BUTTON_LEFT;
+    if (port & _BV(BUTTON_RIGHT_PIN))
+        buttons |= BUTTON_RIGHT;
+    if (port & _BV(BUTTON_SELECT_PIN))
+        buttons |= BUTTON_SELECT;
+    return buttons;
+}
+
+/**
+ * @brief Pin change interrupt for the button pins.
+ *
+ * Every edge is timestamped and debounced as it happens, so even a quick tap between two
+ * input task runs is seen.
+ */
+ISR(PCINT2_vect)
+{
+    acceptButtonEdges(readButtons(), millis());
+}
+
+/**
+ * @brief Debounces button level changes and queues the accepted edges.
+ *
+ * An edge is accepted as soon as it arrives. After an accepted press the button ignores further
+ * edges for DEBOUNCE_DELAY, after an accepted release for POST_PRESS_IGNORE, which swallows contact bounce.
+ * A level change that happened during that time is picked up by the next call once it has passed.
+ *
+ * @param levels The current button levels as returned by readButtons().
+ * @param now The current time in milliseconds.
+ * @note Must be called from the pin change interrupt or with interrupts disabled,
+ *       so there is only ever one producer on the edge queue.
+ */
+void acceptButtonEdges(uint8_t levels, uint16_t now)
+{
+    uint8_t changed = levels ^ debouncedButtons;
+    for (uint8_t i = 0; i < BUTTON_COUNT; i++)
+    {
+        uint8_t mask = 1 << i;
+        if (!(changed & mask))
+        {
+            continue;
+        }
+
+        uint16_t ignoreTime = (debouncedButtons & mask) ? DEBOUNCE_DELAY : POST_PRESS_IGNORE;
+        if ((uint16_t)(now - lastEdgeTime[i]) < ignoreTime)
+        {
+            continue;
+        }
+
+        uint8_t head = buttonEdgeHead;
+        if ((uint8_t)(head - buttonEdgeTail) >= BUTTON_QUEUE_SIZE)
+        {
+            return; // queue full, the edge is picked up again once the UI has caught up
+        }
+
+        debouncedButtons ^= mask;
+        lastEdgeTime[i] = now;
+
+        volatile ButtonEdge &edge = buttonEdges[head % BUTTON_QUEUE_SIZE];
+        edge.button = mask;
+        edge.pressed = levels & mask;
+        edge.time = now;
+        buttonEdgeHead = head + 1;
+    }
+}
+
+/**
+ * @brief Turns queued button edges into press, release, long-press and repeat events.
+ *
+ * This function drains the edge queue filled by the pin change interrupt and tracks the held button,
+ * sending BUTTON_LONG_PRESS once it has been held for LONG_PRESS_TIME and BUTTON_REPEAT every
+ * REPEAT_INTERVAL after REPEAT_DELAY. Select does not repeat.
+ */
+void handleButtons()
+{
+    // Pick up a level change that arrived while its button was still ignoring edges
+    noInterrupts();
+    acceptButtonEdges(readButtons(), millis());
+    interrupts();
+
+    while (buttonEdgeTail != buttonEdgeHead)
+    {
+        volatile ButtonEdge &edge = buttonEdges[buttonEdgeTail % BUTTON_QUEUE_SIZE];
+        uint8_t button = edge.button;
+        bool pressed = edge.pressed;
+        uint16_t time = edge.time;
+        buttonEdgeTail++;
+
+        if (pressed)
+        {
+            heldButton = button;
+            heldSince = time;
+            nextRepeatTime = time + REPEAT_DELAY;
+            repeatCount = 0;
+            longPressSent = false;
+            handleButtonEvent(button, BUTTON_PRESS, 0);
+        }
+        else
+        {
+            if (button == heldButton)
+            {
+                heldButton = 0;
+            }
+            handleButtonEvent(button, BUTTON_RELEASE, 0);
+        }
+    }
+
+    if (!heldButton)
+    {
+        return;
+    }
+
+    uint16_t now = millis();
+    if (!longPressSent && (uint16_t)(now - heldSince) >= LONG_PRESS_TIME)
+    {
+        longPressSent = true;
+        handleButtonEvent(heldButton, BUTTON_LONG_PRESS, 0);
+    }
+    if (heldButton != BUTTON_SELECT && (int16_t)(now - nextRepeatTime) >= 0)
+    {
+        if (repeatCount < 255)
+        {
+            repeatCount++;
+        }
+        nextRepeatTime += REPEAT_INTERVAL;
+        handleButtonEvent(heldButton, BUTTON_REPEAT, repeatCount);
+    }
+}
+
+/**
+ * @brief Performs the action of a button event based on the current screen.
+ *
+ * Presses and repeats are dispatched through the screen's descriptor in screens[]:
+ * up and down move through its selectable items, left and right step the selected item's value
+ * and select runs the item's action. On a screen without selectable items select goes back.
+ * On the main screen left and right page through the tanks.
+ * A long press on select returns to the main screen from anywhere.
+ * Any key wakes the display; while it is off, the press only does that.
+ *
+ * @param button The button mask (BUTTON_UP, BUTTON_DOWN, ...).
+ * @param event The event type (BUTTON_PRESS, BUTTON_RELEASE, BUTTON_LONG_PRESS or BUTTON_REPEAT).
+ * @param repeats How many times a held button has repeated, used to accelerate adjustments.
+ */
+void handleButtonEvent(uint8_t button, uint8_t event, uint8_t repeats)
+{
+    if (event == BUTTON_RELEASE)
+    {
+        return;
+    }
+    displayDirty = true;
+    lastInputTime = millis();
+    if (!inputPending)
+    {
+        inputTime = lastInputTime;
+        inputPending = true;
+    }
+
+    // The press that turns the display back on does nothing else
+    if (displayPower == DISPLAY_OFF)
+    {
+        return;
+    }
+
+    if (event == BUTTON_LONG_PRESS)
+    {
+        if (button == BUTTON_SELECT)
+        {
+            showScreen(MAIN_SCREEN);
+        }
+        return;
+    }
+
+    MenuScreen screen;
+    memcpy_P(&screen, &screens[currentScreen], sizeof(MenuScreen));
+
+    if (screen.selectable == 0)
+    {
+        if (button == BUTTON_SELECT)
+        {
+            showScreen(screen.back);
+        }
+        if (currentScreen == MAIN_SCREEN && (button == BUTTON_LEFT || button == BUTTON_RIGHT))
+        {
+            selectTank((currentTank + (button == BUTTON_RIGHT ? 1 : TANK_COUNT - 1)) % TANK_COUNT);
+        }
+        return;
+    }
+
+    // up and down to navigate menu
+    if (button == BUTTON_UP)
+    {
+        menuItem = menuItem <= 0 ? screen.selectable - 1 : menuItem - 1;
+        return;
+    }
+    if (button == BUTTON_DOWN)
+    {
+        menuItem = (menuItem + 1) % screen.selectable;
+        return;
+    }
+    if (menuItem < 0)
+    {
+        return;
+    }
+
+    MenuItem item;
+    memcpy_P(&item, &screen.items[menuItem], sizeof(MenuItem));
+
+    if ((button == BUTTON_LEFT || button == BUTTON_RIGHT) && item.step != 0)
+    {
+        adjustItem(item, button == BUTTON_RIGHT, repeats);
+    }
+    if (button == BUTTON_SELECT)
+    {
+        if (item.select)
+        {
+            item.select();
+        }
+        if (item.screen != NO_SCREEN)
+        {
+            showScreen(item.screen);
+        }
+    }
+}
+
+/**
+ * @brief Shows a screen with no item selected.
+ *
+ * @param screen The screen number (MAIN_SCREEN, MENU_SCREEN, ...).
+ */
+void showScreen(uint8_t screen)
+{
+    currentScreen = screen;
+    menuItem = -1;
+
+    void (*enter)() = reinterpret_cast<void (*)()>(pgm_read_ptr(&screens[screen].enter));
+    if (enter)
+    {
+        enter();
+    }
+}
+
+/**
+ * @brief Steps the value bound to a menu item.
+ *
+ * The value changes by the item's step, or by 5 and 10 steps once the key has been held
+ * for ACCELERATE_REPEATS and twice as many repeats, and stays within the item's range.
+ * Items with ITEM_WRAP cycle through their range one step at a time instead.
+ *
+ * @param item The menu item, copied from flash.
+ * @param increase A boolean value that indicates whether to increase the value.
+ * @param repeats How many times the key has repeated while held, 0 for a single press.
+ */
+void adjustItem(const MenuItem &item, bool increase, uint8_t repeats)
+{
+    long value = readItemValue(item);
+    long step = increase ? item.step : -item.step;
+
+    if (item.flags & ITEM_WRAP)
+    {
+        long range = (long)item.maximum - item.minimum + 1;
+        value = item.minimum + (value - item.minimum + step + range) % range;
+    }
+    else
+    {
+        if (repeats >= 2 * ACCELERATE_REPEATS)
+        {
+            step *= 10;
+        }
+        else if (repeats >= ACCELERATE_REPEATS)
+        {
+            step *= 5;
+        }
+        value = constrain(value + step, (long)item.minimum, (long)item.maximum);
+    }
+
+    writeItemValue(item, value);
+    if (item.changed)
+    {
+        item.changed();
+    }
+}
+
+/**
+ * @brief Reads the value bound to a menu item.
+ *
+ * @param item The menu item, copied from flash.
+ * @return The value, 0 for items without one.
+ */
+long readItemValue(const MenuItem &item)
+{
+    void *value = itemValue(item);
+    switch (item.type)
+    {
+    case VALUE_UINT8:
+        return *static_cast<uint8_t *>(value);
+    case VALUE_INT8:
+        return *static_cast<int8_t *>(value);
+    case VALUE_UINT16:
+        return *static_cast<uint16_t *>(value);
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Writes the value bound to a menu item.
+ *
+ * @param item The menu item, copied from flash.
+ * @param value The new value, already within the item's range.
+ */
+void writeItemValue(const MenuItem &item, long value)
+{
+    void *bound = itemValue(item);
+    switch (item.type)
+    {
+    case VALUE_UINT8:
+        *static_cast<uint8_t *>(bound) = value;
+        break;
+    case VALUE_INT8:
+        *static_cast<int8_t *>(bound) = value;
+        break;
+    case VALUE_UINT16:
+        *static_cast<uint16_t *>(bound) = value;
+        break;
+    }
+}
+
+/**
+ * @brief Returns the address of the value bound to a menu item.
+ *
+ * Items with ITEM_TANK are bound to a member of the first tank, which is moved to the same member of the tank shown.
+ *
+ * @param item The menu item, copied from flash.
+ * @return The address of the value.
+ */
+void *itemValue(const MenuItem &item)
+{
+    if (item.flags & ITEM_TANK)
+    {
+        return static_cast<uint8_t *>(item.value) + currentTank * sizeof(Tank);
+    }
+    return item.value;
+}
+
+/**
+ * @brief Sets the minimum height to the distance currently measured, with the tank empty.
+ *
+ * Without a valid level estimate the setting is left as it is, a minimum height of 0 would unconfigure the tank.
+ */
+void captureMinHeight()
+{
+    Tank &tank = tanks[currentTank];
+    uint16_t distance = filteredDistance(tank);
+    if (distance == NO_ECHO)
+    {
+        return;
+    }
+    tank.setting.minHeight = distance;
+    updateTankGeometry(tank);
+}
+
+/**
+ * @brief Starts the load screen on the setting of the tank shown.
+ */
+void enterLoadScreen()
+{
+    loadIndex = tanks[currentTank].profile;
+    loadPreview();
+}
+
+/**
+ * @brief Reads the profile picked on the load screen for its preview rows.
+ */
+void loadPreview()
+{
+    loadProfile(loadIndex, previewSetting);
+}
+
+/**
+ * @brief Makes the profile picked on the load screen the setting of the tank shown.
+ */
+void loadPickedProfile()
+{
+    selectProfile(loadIndex);
+}
+
+/**
+ * @brief Starts the calibration of the tank shown from its current minimum height, unless one is under way.
+ */
+void enterCalibrateScreen()
+{
+    if (calibration.emptyDistance == 0)
+    {
+        calibration.emptyDistance = tanks[currentTank].setting.minHeight;
+    }
+}
+
+/**
+ * @brief Drops the calibration points and the empty level, for a calibration of another tank.
+ *
+ * The recorded table may still be on its way to the EEPROM memory, so it is then left for persistSettings()
+ * to finish. No point can be captured into it before that, since captures wait for staged bytes.
+ */
+void resetCalibration()
+{
+    if (stagedLength > 0 && stagedSource == reinterpret_cast<const uint8_t *>(&calibration.table))
+    {
+        memset(&calibration, 0, offsetof(Calibration, table));
+    }
+    else
+    {
+        memset(&calibration, 0, sizeof(calibration));
+    }
+}
+
+/**
+ * @brief Starts averaging pings for the empty level of the tank shown, which also drops the points recorded.
+ *
+ * Nothing happens while staged bytes, perhaps a recorded table, are still being written.
+ */
+void captureEmptyLevel()
+{
+    if (stagedLength > 0)
+    {
+        return;
+    }
+    calibration.state = CALIBRATION_EMPTY;
+    calibration.pings = 0;
+    calibration.distanceSum = 0;
+}
+
+/**
+ * @brief Starts averaging pings for a point at the level reached after pouring in the litres set on the screen.
+ *
+ * Nothing happens while the table is full or a recorded table is still being written.
+ */
+void captureCalibrationPoint()
+{
+    if (calibration.emptyDistance == 0 || calibration.points >= GEOMETRY_TABLE_SIZE - 1 || stagedLength > 0)
+    {
+        return;
+    }
+    calibration.state = CALIBRATION_POINT;
+    calibration.pings = 0;
+    calibration.distanceSum = 0;
+}
+
+/**
+ * @brief Adds a filtered ping of the tank shown to the calibration average, if one is being taken.
+ *
+ * After CALIBRATION_PINGS of them the mean becomes the empty level or the height of a new point.
+ * A point whose level is not above the previous one is left out, since the table must rise.
+ *
+ * @param tank The tank the ping is of.
+ * @param distance The median distance to the surface, mm in Q8.
+ */
+void addCalibrationPing(const Tank &tank, int32_t distance)
+{
+    if (calibration.state == CALIBRATION_IDLE || &tank != &tanks[currentTank])
+    {
+        return;
+    }
+    calibration.distanceSum += distance;
+    if (++calibration.pings < CALIBRATION_PINGS)
+    {
+        return;
+    }
+
+    uint16_t mean = (calibration.distanceSum / CALIBRATION_PINGS + 128) >> 8;
+    if (calibration.state == CALIBRATION_EMPTY)
+    {
+        uint16_t added = calibration.added;
+        memset(&calibration, 0, sizeof(calibration));
+        calibration.emptyDistance = mean;
+        calibration.added = added;
+        calibration.table.count = 1;
+    }
+    else if (mean < calibration.emptyDistance)
+    {
+        uint16_t height = calibration.emptyDistance - mean;
+        GeometryTable &table = calibration.table;
+        if (height > table.points[calibration.points].height)
+        {
+            calibration.volume += (uint32_t)calibration.added * 1000;
+            addCalibrationPoint(height, calibration.volume);
+        }
+    }
+    calibration.state = CALIBRATION_IDLE;
+    displayDirty = true;
+}
+
+/**
+ * @brief Records a calibration point and adds it to the sums of the least-squares fit of volume to height.
+ *
+ * The sums are exact integers, so the fit needs no stored history and no floating-point.
+ *
+ * @param height The height of the level above the empty level in mm.
+ * @param volume The volume poured in since the empty level in mL.
+ */
+void addCalibrationPoint(uint16_t height, uint32_t volume)
+{
+    uint8_t points = ++calibration.points;
+    calibration.table.points[points].height = height;
+    calibration.table.points[points].volume = volume;
+    calibration.table.count = points + 1;
+
+    calibration.heightSum += height;
+    calibration.volumeSum += volume;
+    calibration.heightSquares += (uint32_t)height * height;
+    calibration.heightVolumes += (uint64_t)height * volume;
+}
+
+/**
+ * @brief Rounds the square root of a number to the nearest integer, bit by bit.
+ *
+ * @param value The number.
+ * @return The square root, rounded.
+ */
+uint16_t squareRoot(uint32_t value)
+{
+    uint32_t root = 0;
+    for (uint32_t bit = 1UL << 30; bit > 0; bit >>= 2)
+    {
+        if (value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+    }
+    return value > root ? root + 1 : root; // value is now what is left over the square of root
+}
+
+/**
+ * @brief Makes the tank shown a cylinder fitted to the calibration points, and saves it.
+ *
+ * The slope of the fitted line is the cross-section, which gives the diameter. Where the line crosses zero volume
+ * is the true bottom, so liquid left in the tank when the empty level was captured, or a sump below it,
+ * is folded into the minimum height. Needs at least two points with a rising volume. All in integers,
+ * with 355/113 for PI.
+ */
+void applyCylinderFit()
+{
+    int64_t points = calibration.points;
+    int64_t heightSum = calibration.heightSum;
+    int64_t volumeSum = calibration.volumeSum;
+    int64_t heightSpread = points * (int64_t)calibration.heightSquares - heightSum * heightSum;
+    int64_t covariance = points * (int64_t)calibration.heightVolumes - heightSum * volumeSum;
+    if (points < 2 || heightSpread <= 0 || covariance <= 0)
+    {
+        return;
+    }
+    // The slope is in mL per mm, so 1000 times it is the cross-section in mm^2
+    int64_t area = (covariance * 1000 + heightSpread / 2) / heightSpread;
+    if (area < 1 || area > (int64_t)MAX_DIAMETER * MAX_DIAMETER * 355 / 452)
+    {
+        return;
+    }
+    uint16_t diameter = squareRoot((area * 452 + 177) / 355); // sqrt(4 * area / PI)
+    int64_t bottom = heightSum * area - volumeSum * 1000; // points * area times the mm above the empty level
+    int64_t scale = points * area;
+    bottom = (bottom + (bottom < 0 ? -scale : scale) / 2) / scale;
+    int64_t minHeight = calibration.emptyDistance - bottom;
+    if (diameter > MAX_DIAMETER || minHeight < 1 || minHeight > 65535)
+    {
+        return;
+    }
+
+    Tank &tank = tanks[currentTank];
+    tank.setting.shape = SHAPE_CYLINDER;
+    tank.setting.diameter = diameter;
+    tank.setting.minHeight = minHeight;
+    updateTankGeometry(tank);
+    saveSettings();
+}
+
+/**
+ * @brief Makes the calibration points the height to volume table of the tank shown, and saves both.
+ *
+ * The table is written to the EEPROM memory in the background from RAM, and the tank switches over to it
+ * once it is complete. Only profiles below GEOMETRY_TABLE_COUNT have room for a table.
+ */
+void applyCalibrationTable()
+{
+    Tank &tank = tanks[currentTank];
+    if (calibration.points < 1 || tank.profile >= GEOMETRY_TABLE_COUNT || stagedLength > 0)
+    {
+        return;
+    }
+
+    stagedAddress = GEOMETRY_TABLE_ADDRESS + tank.profile * sizeof(GeometryTable);
+    stagedSource = reinterpret_cast<const uint8_t *>(&calibration.table);
+    stagedOffset = 0;
+    stagedLength = sizeof(GeometryTable);
+
+    tank.setting.shape = SHAPE_TABLE;
+    tank.setting.minHeight = calibration.emptyDistance;
+    saveSettings();
+}
+
+/**
+ * @brief Updates the display based on the current screen.
+ *
+ * When the screen changes, the framebuffer is cleared and everything is drawn.
+ * Otherwise each screen only redraws the widgets whose content changed, and only the
+ * SSD1306 pages those widgets cover are sent to the panel, by flushDisplay() in the background.
+ * Nothing is drawn unless a button was handled, or on the main screen a new sonar sample arrived,
+ * or on the history screen a minute was logged, and nothing at all while the display is off.
+ */
+void updateDisplay()
+{
+    updateDisplayPower();
+    if (displayPower == DISPLAY_OFF)
+    {
+        return;
+    }
+
+    if (currentScreen == MAIN_SCREEN && sonarHead != renderedSonarHead)
+    {
+        displayDirty = true;
+    }
+    if (currentScreen == HISTORY_SCREEN && logMinuteCount != shownLogMinuteCount)
+    {
+        displayDirty = true;
+    }
+    if (currentScreen == DIAGNOSTICS_SCREEN && millis() - shownDiagnosticsTime >= DIAGNOSTICS_PERIOD)
+    {
+        displayDirty = true;
+    }
+    if (!displayDirty)
+    {
+        return;
+    }
+    displayDirty = false;
+    renderedSonarHead = sonarHead;
+
+    drawScreen();
+    if (inputPending)
+    {
+        inputDrawn = true;
+    }
+}
+
+/**
+ * @brief Draws the current screen, all of it if it was just entered, otherwise only the widgets that changed.
+ *
+ * Every widget drawn marks the pages it covers dirty. With PAGE_RENDERER nothing of the drawing is kept,
+ * this only finds the dirty pages, and renderPage() draws them again one at a time when they are sent.
+ */
+void drawScreen()
+{
+    MenuScreen screen;
+    memcpy_P(&screen, &screens[currentScreen], sizeof(MenuScreen));
+
+    bool redraw = currentScreen != shownScreen;
+    if (redraw)
+    {
+        display.clearDisplay();
+        shownScreen = currentScreen;
+        markDirty(0, display.height());
+    }
+    drawScreenWidgets(screen, redraw);
+}
+
+/**
+ * @brief Draws the title, the widgets and the list rows of a screen.
+ *
+ * @param screen The screen, copied from flash.
+ * @param redraw True if the screen was cleared and everything has to be drawn.
+ */
+void drawScreenWidgets(const MenuScreen &screen, bool redraw)
+{
+    display.setTextSize(1);
+    display.setTextColor(WHITE);
+    display.setCursor(0, 0);
+
+    if (screen.title)
+    {
+        // Only the main screen is ever inverted
+        setInverted(false);
+        if (redraw)
+        {
+            display.setCursor((display.width() - strlen_P(screen.title) * 6) / 2, 0);
+            display.println(FPSTR(screen.title));
+            display.drawLine(0, 10, display.width(), 10, WHITE);
+        }
+    }
+    if (screen.draw)
+    {
+        screen.draw(redraw);
+    }
+    if (screen.count > 0)
+    {
+        updateListScreen(screen, redraw);
+    }
+}
+
+/**
+ * @brief Dims the display, then turns it off, after a while without a key press.
+ *
+ * A raised fill alarm keeps it on. It goes off on the main screen, and is redrawn in full when it comes back on,
+ * since nothing was drawn meanwhile.
+ */
+void updateDisplayPower()
+{
+    bool alarm = false;
+    for (const Tank &tank : tanks)
+    {
+        alarm |= tank.prediction.alarm;
+    }
+
+    unsigned long idle = millis() - lastInputTime;
+    uint8_t power = DISPLAY_OFF;
+    if (alarm || idle < DISPLAY_DIM_TIME)
+    {
+        power = DISPLAY_ON;
+    }
+    else if (idle < DISPLAY_OFF_TIME)
+    {
+        power = DISPLAY_DIM;
+    }
+    if (power == displayPower)
+    {
+        return;
+    }
+
+    if (power == DISPLAY_OFF)
+    {
+        display.ssd1306_command(SSD1306_DISPLAYOFF);
+        showScreen(MAIN_SCREEN);
+    }
+    else if (displayPower == DISPLAY_OFF)
+    {
+        display.ssd1306_command(SSD1306_DISPLAYON);
+        shownScreen = -1;
+        displayDirty = true;
+    }
+    display.dim(power != DISPLAY_ON);
+    displayPower = power;
+}
+
+/**
+ * @brief Draws the rows of a list screen from its items.
+ *
+ * The list scrolls to keep the selected row in view when there are more rows than fit below the title.
+ *
+ * @param screen The screen, copied from flash.
+ * @param redraw True if the screen was cleared and everything has to be drawn.
+ */
+void updateListScreen(const MenuScreen &screen, bool redraw)
+{
+    listScroll = menuItem >= MAX_ROWS ? menuItem - MAX_ROWS + 1 : 0;
+    bool scrolled = listScroll != shownListScroll;
+    shownListScroll = listScroll;
+
+    for (uint8_t i = listScroll; i < screen.count && i < listScroll + MAX_ROWS; i++)
+    {
+        MenuItem item;
+        memcpy_P(&item, &screen.items[i], sizeof(MenuItem));
+
+        long value = readItemValue(item);
+        if (item.flags & ITEM_SHAPE_NAME)
+        {
+            drawRow(i, shapeName(value), false, value, redraw || scrolled);
+        }
+        else
+        {
+            drawRow(i, FPSTR(item.label), item.type != VALUE_NONE, value, redraw || scrolled);
+        }
+    }
+}
+
+/**
+ * @brief Marks the display pages covered by a rectangle as needing a transfer.
+ *
+ * @param y The top of the changed area in pixels.
+ * @param height The height of the changed area in pixels.
+ */
+void markDirty(int16_t y, int16_t height)
+{
+    int16_t first = max(y, 0) / 8;
+    int16_t last = min(y + height - 1, display.height() - 1) / 8;
+    for (int16_t page = first; page <= last; page++)
+    {
+        dirtyPages |= 1 << page;
+    }
+}
+
+/**
+ * @brief Sends the next chunks of the dirty pages of the framebuffer to the display.
+ *
+ * Consecutive dirty pages are sent as one page-addressed window, so an unchanged frame costs no I2C traffic at all.
+ * Each run sends at most OLED_FLUSH_CHUNKS Wire transactions, so a full frame is spread over several runs and the
+ * other tasks keep their rate while it is in flight. A page drawn into while it is being sent is marked dirty again
+ * and sent once more, so the panel always ends up with the last frame. After a failed transfer nothing is sent
+ * until reconnectDisplay() has set the display up again.
+ */
+void flushDisplay()
+{
+    if (displayFault)
+    {
+        if (millis() - displayFaultTime >= DISPLAY_RETRY_PERIOD)
+        {
+            reconnectDisplay();
+        }
+        return;
+    }
+
+    uint16_t started = TCNT1;
+    bool sent = false;
+
+    for (uint8_t chunks = 0; chunks < OLED_FLUSH_CHUNKS; chunks++)
+    {
+        if (flushRemaining == 0 && !openFlushWindow())
+        {
+            if (displayFault)
+            {
+                break;
+            }
+            if (flushing)
+            {
+                flushing = false;
+                stats.frames++;
+            }
+            if (inputDrawn)
+            {
+                stats.inputLatency = min(millis() - inputTime, 0xFFFFUL);
+                stats.maxInputLatency = max(stats.maxInputLatency, stats.inputLatency);
+                inputPending = false;
+                inputDrawn = false;
+            }
+            break;
+        }
+        flushing = true;
+        sent = true;
+
+        uint8_t chunk = min(flushRemaining, (uint16_t)OLED_DATA_CHUNK);
+        stats.displayBytes += 1 + chunk;
+        Wire.beginTransmission(OLED_ADDRESS);
+        Wire.write((uint8_t)0x40); // Co = 0, D/C = 1: the rest of the transaction is display data
+        Wire.write(flushData, chunk);
+        if (Wire.endTransmission() != 0)
+        {
+            failDisplay();
+            break;
+        }
+        flushData += chunk;
+        flushRemaining -= chunk;
+    }
+
+    if (sent)
+    {
+        addTiming(TIMING_FLUSH, started);
+    }
+}
+
+/**
+ * @brief Opens a page-addressed window over the next run of dirty pages for flushDisplay() to stream into.
+ *
+ * The display runs in horizontal addressing mode, so after setting the page and column window
+ * the bytes can be streamed in as many I2C transactions as the Wire buffer requires.
+ * The six window commands go in one transaction, instead of one each through ssd1306_command().
+ * The pages count as clean from here on, a draw into them marks them dirty again.
+ * With PAGE_RENDERER the window is a single page, drawn here into the page buffer.
+ *
+ * @return False if no page is dirty, or the display did not take the window.
+ */
+bool openFlushWindow()
+{
+    uint8_t first = 0;
+    while (first < 8 && !(dirtyPages & (1 << first)))
+    {
+        first++;
+    }
+    if (first >= 8)
+    {
+        return false;
+    }
+
+    uint8_t last = first;
+#ifdef PAGE_RENDERER
+    // Only the one page drawn just now is in RAM
+    renderPage(first);
+    flushData = display.getBuffer();
+#else
+    while (last < 7 && (dirtyPages & (1 << (last + 1))))
+    {
+        last++;
+    }
+    for (uint8_t i = first; i <= last; i++)
+    {
+        dirtyPages &= ~(1 << i);
+    }
+    flushData = display.getBuffer() + first * display.width();
+#endif
+
+    uint8_t commands[] = {SSD1306_PAGEADDR, first, last, SSD1306_COLUMNADDR, 0, (uint8_t)(display.width() - 1)};
+    Wire.beginTransmission(OLED_ADDRESS);
+    Wire.write((uint8_t)0x00); // Co = 0, D/C = 0: the rest of the transaction is commands
+    Wire.write(commands, sizeof(commands));
+    if (Wire.endTransmission() != 0)
+    {
+        failDisplay();
+        return false;
+    }
+    stats.displayBytes += 1 + sizeof(commands);
+
+    flushRemaining = (last - first + 1) * display.width();
+    return true;
+}
+
+/**
+ * @brief Stops with the fills cut off and the error LED blinking, for a display that cannot be set up.
+ *
+ * Nothing else could show the levels or take a key, so no tank may be left filling unwatched.
+ */
+void haltWithError()
+{
+    for (uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        digitalWrite(cutoffPins[i], LOW);
+        pinMode(cutoffPins[i], OUTPUT);
+    }
+    pinMode(ERROR_LED_PIN, OUTPUT);
+    while (true)
+    {
+        digitalWrite(ERROR_LED_PIN, !digitalRead(ERROR_LED_PIN));
+        delay(ERROR_BLINK_PERIOD);
+    }
+}
+
+/**
+ * @brief Gives up on the frame being sent after a failed transfer, for flushDisplay() to reconnect the display.
+ *
+ * The display did not acknowledge, or the transfer hit OLED_WIRE_TIMEOUT and Wire already reset the TWI.
+ */
+void failDisplay()
+{
+    displayFault = true;
+    displayFaultTime = millis();
+    flushRemaining = 0;
+    flushing = false;
+}
+
+/**
+ * @brief Clears the I2C bus and sets the display up again, without a reboot.
+ *
+ * A device cut off in the middle of a byte holds SDA low until it has clocked out the rest, so SCL is pulsed
+ * up to nine times until SDA is released, and a stop condition ends the transfer, as the I2C bus clear does.
+ * begin() resets the panel and clears the framebuffer, so the power state is put back and the screen drawn again
+ * in full. If the display is still not there, this is tried again after DISPLAY_RETRY_PERIOD.
+ */
+void reconnectDisplay()
+{
+    stats.busRecoveries++;
+    Wire.end();
+    pinMode(SDA, INPUT_PULLUP);
+    pinMode(SCL, INPUT_PULLUP);
+    for (uint8_t i = 0; i < 9 && digitalRead(SDA) == LOW; i++)
+    {
+        digitalWrite(SCL, LOW);
+        pinMode(SCL, OUTPUT);
+        delayMicroseconds(5);
+        pinMode(SCL, INPUT_PULLUP);
+        delayMicroseconds(5);
+    }
+    digitalWrite(SDA, LOW);
+    pinMode(SDA, OUTPUT);
+    delayMicroseconds(5);
+    pinMode(SDA, INPUT_PULLUP);
+
+    if (!display.begin(SSD1306_SWITCHCAPVCC, OLED_ADDRESS))
+    {
+        failDisplay();
+        return;
+    }
+    if (displayPower == DISPLAY_OFF)
+    {
+        display.ssd1306_command(SSD1306_DISPLAYOFF);
+    }
+    display.dim(displayPower != DISPLAY_ON);
+    shownInverted = false;
+    shownScreen = -1;
+    displayDirty = true;
+    displayFault = false;
+    displayFaultTime = millis();
+}
+
+#ifdef PAGE_RENDERER
+/**
+ * @brief Draws one page of the current screen into the page buffer.
+ *
+ * The widgets that changed since the last pass are looked for first, so their pages are marked dirty
+ * and sent after this one. Then the whole screen is drawn with everything outside the page clipped away.
+ * That draw marks every page it touches dirty again, so the dirty pages found before it are put back, less this one.
+ *
+ * @param page The page (0-7) to draw.
+ */
+void renderPage(uint8_t page)
+{
+    drawScreen();
+    uint8_t pages = dirtyPages & ~(1 << page);
+
+    MenuScreen screen;
+    memcpy_P(&screen, &screens[currentScreen], sizeof(MenuScreen));
+    display.selectPage(page);
+    display.clearDisplay();
+    drawScreenWidgets(screen, true);
+    display.selectPage(NO_PAGE);
+    dirtyPages = pages;
+}
+
+/**
+ * @brief Resets and sets up the panel in horizontal addressing mode, as Adafruit_SSD1306 does for 128x64.
+ *
+ * @param vccState SSD1306_SWITCHCAPVCC to have the panel make its own drive voltage, or SSD1306_EXTERNALVCC.
+ * @param address The I2C address of the panel.
+ * @return False if the panel did not answer.
+ */
+bool PageDisplay::begin(uint8_t vccState, uint8_t address)
+{
+    bool external = vccState != SSD1306_SWITCHCAPVCC;
+    this->address = address;
+    contrast = external ? 0x9F : 0xCF;
+
+    Wire.begin();
+    Wire.setClock(OLED_I2C_CLOCK);
+    if (resetPin >= 0)
+    {
+        pinMode(resetPin, OUTPUT);
+        digitalWrite(resetPin, HIGH);
+        delay(1);
+        digitalWrite(resetPin, LOW);
+        delay(10);
+        digitalWrite(resetPin, HIGH);
+    }
+
+    const uint8_t commands[] = {
+        SSD1306_DISPLAYOFF, SSD1306_SETDISPLAYCLOCKDIV, 0x80, SSD1306_SETMULTIPLEX, (uint8_t)(height() - 1),
+        SSD1306_SETDISPLAYOFFSET, 0, SSD1306_SETSTARTLINE | 0, SSD1306_CHARGEPUMP, (uint8_t)(external ? 0x10 : 0x14),
+        SSD1306_MEMORYMODE, 0x00, SSD1306_SEGREMAP | 1, SSD1306_COMSCANDEC, SSD1306_SETCOMPINS, 0x12,
+        SSD1306_SETCONTRAST, contrast, SSD1306_SETPRECHARGE, (uint8_t)(external ? 0x22 : 0xF1),
+        SSD1306_SETVCOMDETECT, 0x40, SSD1306_DISPLAYALLON_RESUME, SSD1306_NORMALDISPLAY,
+        SSD1306_DEACTIVATE_SCROLL, SSD1306_DISPLAYON};
+    Wire.beginTransmission(address);
+    Wire.write((uint8_t)0x00); // Co = 0, D/C = 0: the rest of the transaction is commands
+    Wire.write(commands, sizeof(commands));
+    return Wire.endTransmission() == 0;
+}
+
+/**
+ * @brief Picks the page drawing lands in.
+ *
+ * @param index The page (0-7), or NO_PAGE to clip everything.
+ */
+void PageDisplay::selectPage(uint8_t index)
+{
+    page = index;
+}
+
+/**
+ * @brief Clears the page being drawn.
+ *
+ * Without a page picked nothing is kept of the drawing anyway, and the page buffer may still be on its way to the panel.
+ */
+void PageDisplay::clearDisplay()
+{
+    if (page != NO_PAGE)
+    {
+        memset(buffer, 0, sizeof(buffer));
+    }
+}
+
+/**
+ * @brief Sets, clears or flips a pixel if it is on the page being drawn.
+ *
+ * @param x The column.
+ * @param y The row on the whole panel.
+ * @param color WHITE, BLACK or INVERSE.
+ */
+void PageDisplay::drawPixel(int16_t x, int16_t y, uint16_t color)
+{
+    if (x < 0 || x >= width() || y < 0 || y >= height() || (y >> 3) != page)
+    {
+        return;
+    }
+    uint8_t mask = 1 << (y & 7);
+    switch (color)
+    {
+    case WHITE:
+        buffer[x] |= mask;
+        break;
+    case BLACK:
+        buffer[x] &= ~mask;
+        break;
+    case INVERSE:
+        buffer[x] ^= mask;
+        break;
+    }
+}
+
+/**
+ * @brief Draws a horizontal line, through fillRect().
+ *
+ * @param x The left end.
+ * @param y The row.
+ * @param w The length in pixels.
+ * @param color WHITE, BLACK or INVERSE.
+ */
+void PageDisplay::drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color)
+{
+    fillRect(x, y, w, 1, color);
+}
+
+/**
+ * @brief Draws a vertical line, through fillRect().
+ *
+ * @param x The column.
+ * @param y The top end.
+ * @param h The length in pixels.
+ * @param color WHITE, BLACK or INVERSE.
+ */
+void PageDisplay::drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color)
+{
+    fillRect(x, y, 1, h, color);
+}
+
+/**
+ * @brief Fills the part of a rectangle that is on the page being drawn, a byte per column.
+ *
+ * @param x The left edge.
+ * @param y The top edge.
+ * @param w The width in pixels.
+ * @param h The height in pixels.
+ * @param color WHITE, BLACK or INVERSE.
+ */
+void PageDisplay::fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+{
+    if (page == NO_PAGE)
+    {
+        return;
+    }
+    int16_t top = page * 8;
+    int16_t first = max(y, top) - top;
+    int16_t last = min(y + h, top + 8) - 1 - top;
+    int16_t left = max(x, (int16_t)0);
+    int16_t right = min(x + w, width());
+    if (first > last || left >= right)
+    {
+        return;
+    }
+
+    uint8_t mask = (uint8_t)(0xFF << first) & (0xFF >> (7 - last));
+    for (int16_t column = left; column < right; column++)
+    {
+        switch (color)
+        {
+        case WHITE:
+            buffer[column] |= mask;
+            break;
+        case BLACK:
+            buffer[column] &= ~mask;
+            break;
+        case INVERSE:
+            buffer[column] ^= mask;
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Inverts the whole panel, in the controller.
+ *
+ * @param inverted True to invert the panel.
+ */
+void PageDisplay::invertDisplay(bool inverted)
+{
+    ssd1306_command(inverted ? SSD1306_INVERTDISPLAY : SSD1306_NORMALDISPLAY);
+}
+
+/**
+ * @brief Dims the panel to the lowest contrast, or brings it back.
+ *
+ * @param dim True to dim the panel.
+ */
+void PageDisplay::dim(bool dim)
+{
+    Wire.beginTransmission(address);
+    Wire.write((uint8_t)0x00);
+    Wire.write((uint8_t)SSD1306_SETCONTRAST);
+    Wire.write(dim ? (uint8_t)0 : contrast);
+    Wire.endTransmission();
+}
+
+/**
+ * @brief Sends a single command byte to the panel.
+ *
+ * @param command The SSD1306 command.
+ */
+void PageDisplay::ssd1306_command(uint8_t command)
+{
+    Wire.beginTransmission(address);
+    Wire.write((uint8_t)0x00);
+    Wire.write(command);
+    Wire.endTransmission();
+}
+#endif
+
+/**
+ * @brief Sets the display inversion, sending the command only when it changes.
+ *
+ * @param inverted True to invert the display.
+ */
+void setInverted(bool inverted)
+{
+    if (inverted != shownInverted)
+    {
+        display.invertDisplay(inverted);
+        shownInverted = inverted;
+    }
+}
+
+/**
+ * @brief Draws a row of a list screen if its content or highlight changed.
+ *
+ * @param row The row index, drawn at y = (row - listScroll) * 10 + 11.
+ * @param label The text of the row.
+ * @param hasValue True to print the value after the label.
+ * @param value The value to print after the label, also compared to tell if the row changed.
+ * @param redraw True to draw the row even if it did not change.
+ */
+void drawRow(uint8_t row, const __FlashStringHelper *label, bool hasValue, long value, bool redraw)
+{
+    bool highlighted = row == menuItem;
+    uint8_t slot = row - listScroll;
+    if (!redraw && shownRows[slot].value == value && shownRows[slot].highlighted == highlighted)
+    {
+        return;
+    }
+    shownRows[slot].value = value;
+    shownRows[slot].highlighted = highlighted;
+
+    int16_t y = slot * 10 + 11;
+    if (highlighted)
+    {
+        display.fillRect(0, y, display.width(), 10, WHITE);
+        display.setTextColor(BLACK, WHITE);
+    }
+    else
+    {
+        display.fillRect(0, y, display.width(), 10, BLACK);
+        display.setTextColor(WHITE, BLACK);
+    }
+    display.setCursor(0, y);
+    display.print(label);
+    if (hasValue)
+    {
+        display.print(value);
+    }
+    markDirty(y, 10);
+}
+
+/**
+ * @brief Updates the main screen with the current volume of the Makgeolli tank.
+ *
+ * This function calculates the volume of the Makgeolli tank based on the current settings and displays it on the screen.
+ * The volume is drawn in large seven-segment glyphs. Above it the fill rate and the time left to the target are shown, and the screen is inverted while the fill alarm
+ * is raised. The volume digits, the rate line and the progress bar are only redrawn when their value changed.
+ * With several tanks the one shown is named below the bar. While the level is lost "no echo" replaces the volume.
+ *
+ * @param redraw True if the screen was cleared and everything has to be drawn.
+ */
+void updateMainScreen(bool redraw)
+{
+    const Tank &tank = tanks[currentTank];
+    const TankGeometry &tankGeometry = tank.geometry;
+    const FillPrediction &fillPrediction = tank.prediction;
+
+    // Switching between the setup hint and the readout changes the whole layout
+    bool configured = tankGeometry.configured;
+    if (!redraw && configured != shownConfigured)
+    {
+        display.clearDisplay();
+        markDirty(0, display.height());
+        redraw = true;
+    }
+    shownConfigured = configured;
+
+    if (TANK_COUNT > 1 && redraw)
+    {
+        display.setTextSize(1);
+        display.setCursor(0, display.height() - 8);
+        display.print(F("Tank "));
+        display.print(currentTank + 1);
+        display.print('/');
+        display.print(TANK_COUNT);
+    }
+
+    if (!configured)
+    {
+        if (redraw)
+        {
+            display.setTextSize(1);
+            display.setCursor(0, 0);
+            display.println(F("please set up tank"));
+        }
+        setInverted(false);
+    }
+    else
+    {
+        uint32_t volume = currentVolume(tank);
+
+        // -1 while the level is lost, so a missing echo never reads as a volume
+        long volumeTenths = tank.estimate.valid ? (long)(volume + 50) / 100 : -1;
+        if (redraw || volumeTenths != shownVolumeTenths)
+        {
+            shownVolumeTenths = volumeTenths;
+            display.fillRect(0, VOLUME_PAGE * 8, display.width(), LARGE_GLYPH_PAGES * 8, BLACK);
+            if (volumeTenths < 0)
+            {
+                display.setTextSize(2);
+                display.setCursor((display.width() - 12 * 7) / 2, VOLUME_PAGE * 8 + 4);
+                display.print(F("no echo"));
+            }
+            else
+            {
+                char text[16];
+                ltoa(volumeTenths / 10, text, 10);
+                uint8_t length = strlen(text);
+                text[length++] = '.';
+                text[length++] = '0' + volumeTenths % 10;
+                text[length++] = ' ';
+                text[length++] = 'L';
+                text[length] = '\0';
+                drawLargeText((display.width() - largeTextWidth(text)) / 2, VOLUME_PAGE, text);
+            }
+            markDirty(VOLUME_PAGE * 8, LARGE_GLYPH_PAGES * 8);
+        }
+
+        // Draw progress bar
+        int progressBarWidth = display.width() - 4;
+        int progressBarHeight = 8;
+        int progressBarX = 2;
+        int progressBarY = (display.height() - progressBarHeight) / 2 + 15;
+
+        // In dL, so volume times the bar width stays within 32 bits for any target
+        int progress = progressBarWidth;
+        if (volume < tankGeometry.targetVolume)
+        {
+            progress = (volume / 100) * progressBarWidth / (tankGeometry.targetVolume / 100);
+        }
+
+        if (redraw || progress != shownProgress)
+        {
+            shownProgress = progress;
+            display.fillRect(progressBarX, progressBarY, progressBarWidth, progressBarHeight, BLACK);
+            display.drawRect(progressBarX, progressBarY, progressBarWidth, progressBarHeight, WHITE);
+            display.fillRect(progressBarX, progressBarY, progress, progressBarHeight, WHITE);
+            markDirty(progressBarY, progressBarHeight);
+        }
+
+        // mL/s times 60 / 100 is L/min in tenths
+        int rateTenths = fillPrediction.rate * 3 / 5;
+        uint16_t secondsToTarget = fillPrediction.secondsToTarget;
+        if (redraw || rateTenths != shownRateTenths || secondsToTarget != shownSecondsToTarget)
+        {
+            shownRateTenths = rateTenths;
+            shownSecondsToTarget = secondsToTarget;
+            display.fillRect(0, 0, display.width(), 8, BLACK);
+            display.setTextSize(1);
+            display.setCursor(0, 0);
+            if (rateTenths < 0)
+            {
+                display.print('-');
+            }
+            display.print(abs(rateTenths) / 10);
+            display.print('.');
+            display.print(abs(rateTenths) % 10);
+            display.print(F(" L/min"));
+            if (secondsToTarget != ETA_UNKNOWN)
+            {
+                display.print(F("  ETA "));
+                display.print(secondsToTarget / 60);
+                display.print(':');
+                display.print(secondsToTarget % 60 / 10);
+                display.print(secondsToTarget % 10);
+            }
+            markDirty(0, 8);
+        }
+
+        setInverted(fillPrediction.alarm);
+    }
+}
+
+/**
+ * @brief Draws text in the large glyphs straight into the framebuffer, a page-aligned column byte at a time.
+ *
+ * Only digits, '.', 'L' and spaces are drawn, anything else is left out. The glyphs are opaque, so the cells they
+ * cover do not need to be cleared first, but the gaps between them do.
+ *
+ * @param x The left edge of the text in pixels.
+ * @param page The page (0-7) the top of the text is on.
+ * @param text The text.
+ */
+void drawLargeText(int16_t x, uint8_t page, const char *text)
+{
+    for (; *text; text++)
+    {
+        uint8_t glyph = largeGlyphIndex(*text);
+        if (glyph == NO_GLYPH)
+        {
+            x += *text == ' ' ? LARGE_SPACE_WIDTH : 0;
+            continue;
+        }
+
+        uint8_t width = pgm_read_byte(&largeGlyphWidths[glyph]);
+        for (uint8_t row = 0; row < LARGE_GLYPH_PAGES && page + row < 8; row++)
+        {
+            uint8_t *bytes = framebufferPage(page + row);
+            if (!bytes)
+            {
+                continue;
+            }
+            const uint8_t *columns = &largeGlyphs[glyph][row * LARGE_GLYPH_WIDTH];
+            for (uint8_t column = 0; column < width; column++)
+            {
+                if (x + column >= 0 && x + column < display.width())
+                {
+                    bytes[x + column] = pgm_read_byte(&columns[column]);
+                }
+            }
+        }
+        x += width + LARGE_GLYPH_SPACING;
+    }
+}
+
+/**
+ * @brief Returns how wide text drawn by drawLargeText() is.
+ *
+ * @param text The text.
+ * @return The width in pixels, without the spacing after the last glyph.
+ */
+int16_t largeTextWidth(const char *text)
+{
+    int16_t width = 0;
+    for (; *text; text++)
+    {
+        uint8_t glyph = largeGlyphIndex(*text);
+        if (glyph != NO_GLYPH)
+        {
+            width += pgm_read_byte(&largeGlyphWidths[glyph]) + LARGE_GLYPH_SPACING;
+        }
+        else if (*text == ' ')
+        {
+            width += LARGE_SPACE_WIDTH;
+        }
+    }
+    return width > 0 && text[-1] != ' ' ? width - LARGE_GLYPH_SPACING : width;
+}
+
+/**
+ * @brief Returns the index of a character in largeGlyphs.
+ *
+ * @param c The character.
+ * @return The index, or NO_GLYPH if there is no large glyph of it.
+ */
+uint8_t largeGlyphIndex(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c == '.')
+    {
+        return LARGE_GLYPH_DOT;
+    }
+    return c == 'L' ? LARGE_GLYPH_L : NO_GLYPH;
+}
+
+/**
+ * @brief Returns the bytes of a framebuffer page, for drawing into it a column byte at a time.
+ *
+ * @param page The page (0-7).
+ * @return The page's first byte, or NULL if it is not in RAM (with PAGE_RENDERER, any page but the one being drawn).
+ */
+uint8_t *framebufferPage(uint8_t page)
+{
+#ifdef PAGE_RENDERER
+    return display.pageBuffer(page);
+#else
+    uint8_t *buffer = display.getBuffer();
+    return buffer ? buffer + page * display.width() : NULL;
+#endif
+}
+
+/**
+ * @brief Updates the view settings screen with the current settings.
+ *
+ * This function displays the current settings on the screen.
+ * Nothing on it can change while it is shown, so it is only drawn when the screen is entered.
+ *
+ * @param redraw True if the screen was cleared and everything has to be drawn.
+ */
+void updateViewSettingsScreen(bool redraw)
+{
+    if (!redraw)
+    {
+        return;
+    }
+    const MakgeolliTankSetting &setting = tanks[currentTank].setting;
+
+    display.setCursor(0, 14);
+
+    display.print(F("Min Height: "));
+    display.println(static_cast<int>(setting.minHeight));
+    display.print(F("Diameter: "));
+    display.println(static_cast<int>(setting.diameter));
+    display.print(F("Target Capacity: "));
+    display.println(static_cast<int>(setting.targetCapacity));
+    display.print(F("Temperature: "));
+    display.println(static_cast<int>(setting.temperature));
+    display.println(shapeName(setting.shape));
+    if (setting.shape == SHAPE_TAPERED)
+    {
+        display.print(F("Taper: "));
+        display.print(setting.bottomDiameter);
+        display.print(F(" / "));
+        display.println(setting.taperHeight);
+    }
+}
+
+/**
+ * @brief Updates the history screen with charts of the logged volume.
+ *
+ * The upper chart shows the last LOG_MINUTES minutes from RAM, the lower one as many hours from the log,
+ * newest on the right. Each bar spans the minimum to the maximum with a gap at the mean,
+ * scaled to the target capacity. Both are redrawn when a minute was logged.
+ *
+ * @param redraw True if the screen was cleared and everything has to be drawn.
+ */
+void updateHistoryScreen(bool redraw)
+{
+    if (!redraw && logMinuteCount == shownLogMinuteCount)
+    {
+        return;
+    }
+    shownLogMinuteCount = logMinuteCount;
+
+    uint16_t scale = max(tanks[currentTank].setting.targetCapacity, (uint16_t)1);
+    uint8_t barWidth = display.width() / LOG_MINUTES;
+    display.fillRect(0, 12, display.width(), display.height() - 12, BLACK);
+
+    for (uint8_t age = 0; age < LOG_MINUTES && age < logMinuteCount; age++)
+    {
+        const LogAggregate &minute = logMinutes[(logMinuteCount - 1 - age) % LOG_MINUTES];
+        drawHistoryBar(display.width() - (age + 1) * barWidth, 12, 24, barWidth, minute, scale);
+    }
+
+    uint16_t slot = logSlot;
+    for (uint8_t age = 0; age < LOG_MINUTES; age++)
+    {
+        slot = (slot + LOG_SLOTS - 1) % LOG_SLOTS;
+        LogRecord hour;
+        if (!readLogRecord(slot, hour))
+        {
+            break;
+        }
+        drawHistoryBar(display.width() - (age + 1) * barWidth, 39, 24, barWidth, hour.volume, scale);
+    }
+
+    display.drawFastHLine(0, 37, display.width(), WHITE);
+    markDirty(12, display.height() - 12);
+}
+
+/**
+ * @brief Draws one bar of a history chart.
+ *
+ * @param x The left edge of the bar in pixels.
+ * @param y The top of the chart in pixels.
+ * @param height The height of the chart in pixels.
+ * @param width The width of the bar in pixels, including a one pixel gap.
+ * @param aggregate The volumes to draw, in L.
+ * @param scale The volume at the top of the chart in L.
+ */
+void drawHistoryBar(int16_t x, int16_t y, uint8_t height, uint8_t width, const LogAggregate &aggregate, uint16_t scale)
+{
+    int16_t bottom = y + height - 1;
+    int16_t top = bottom - (int16_t)min((uint32_t)aggregate.maximum * (height - 1) / scale, (uint32_t)height - 1);
+    int16_t low = bottom - (int16_t)min((uint32_t)aggregate.minimum * (height - 1) / scale, (uint32_t)height - 1);
+    int16_t mean = bottom - (int16_t)min((uint32_t)aggregate.mean * (height - 1) / scale, (uint32_t)height - 1);
+
+    display.fillRect(x, top, width - 1, low - top + 1, WHITE);
+    display.drawFastHLine(x, mean, width - 1, BLACK);
+}
+
+/**
+ * @brief Updates the diagnostics screen with the timed sections, the free SRAM and the ping timeouts.
+ *
+ * Each section shows its minimum, mean and maximum run time in us since the timings were last started over.
+ * Redrawn every DIAGNOSTICS_PERIOD.
+ *
+ * @param redraw True if the screen was cleared and everything has to be drawn.
+ */
+void updateDiagnosticsScreen(bool redraw)
+{
+    if (!redraw && millis() - shownDiagnosticsTime < DIAGNOSTICS_PERIOD)
+    {
+        return;
+    }
+    shownDiagnosticsTime = millis();
+    display.fillRect(0, 12, display.width(), display.height() - 12, BLACK);
+    display.setCursor(0, 14);
+
+    for (uint8_t i = 0; i < TIMING_SECTIONS; i++)
+    {
+        const SectionTiming &timing = timings[i];
+        display.print(flashString(timingLabels, i));
+        display.setCursor(36, display.getCursorY());
+        if (timing.count > 0)
+        {
+            display.print((uint32_t)timing.minimum * TIMING_TICK_US);
+            display.print(' ');
+            display.print(timing.total / timing.count * TIMING_TICK_US);
+            display.print(' ');
+            display.print((uint32_t)timing.maximum * TIMING_TICK_US);
+        }
+        display.println();
+    }
+    display.print(F("Free RAM: "));
+    display.println(freeStackLowWater());
+    display.print(F("Ping timeouts: "));
+    display.print(stats.pingTimeouts);
+    markDirty(12, display.height() - 12);
+}
+
+/**
+ * @brief Returns the edit settings label of a tank shape.
+ *
+ * @param shape The shape (SHAPE_CYLINDER, SHAPE_TAPERED or SHAPE_TABLE).
+ * @return The label, including the shape's name.
+ */
+const __FlashStringHelper *shapeName(uint8_t shape)
+{
+    return flashString(shapeLabels, shape < SHAPE_COUNT ? shape : SHAPE_CYLINDER);
+}
+
+/**
+ * @brief Returns an entry of a string table in flash.
+ *
+ * @param table The PROGMEM table of PROGMEM strings.
+ * @param index The entry index.
+ * @return The string, printable with the F() overloads of print().
+ */
+const __FlashStringHelper *flashString(const char *const *table, uint8_t index)
+{
+    return reinterpret_cast<const __FlashStringHelper *>(pgm_read_ptr(&table[index]));
+}
+
+/**
+ * @brief Reads a profile from the EEPROM memory.
+ *
+ * Profiles that were never saved get the defaults.
+ *
+ * @param index The profile index.
+ * @param setting The setting to fill.
+ */
+void loadProfile(int index, MakgeolliTankSetting &setting)
+{
+    if (!loadSettingsRecord(index, &setting, sizeof(MakgeolliTankSetting)))
+    {
+        setting = MakgeolliTankSetting();
+    }
+    sanitizeSetting(setting);
+}
+
+/**
+ * @brief Makes a profile the setting of the tank shown.
+ *
+ * The switch is only queued. persistSettings() makes it once the tank's pending save and batch totals,
+ * which are overwritten in RAM, are written, and so is anything pending of the new profile.
+ *
+ * @param index The profile index.
+ */
+void selectProfile(int index)
+{
+    tanks[currentTank].nextProfile = index;
+}
+
+/**
+ * @brief Checks whether the profile switch queued for a tank can be made.
+ *
+ * The tank's own setting and totals must be saved, and the new profile must have no upload, save by another tank
+ * or record under way, so what is read of it from the EEPROM memory is current.
+ *
+ * @param tank The tank, with nextProfile set.
+ * @return True if nothing the switch depends on is still to be written.
+ */
+bool canSwitchProfile(const Tank &tank)
+{
+    uint8_t index = tank.nextProfile;
+    if (tank.settingDirty || tank.totalsDirty || ((settingsDirty & SETTINGS_DIRTY_UPLOAD) && uploadKey == index))
+    {
+        return false;
+    }
+    if (persistOffset > 0 && (persistKey == index || persistKey == SETTINGS_KEY_TOTALS + index))
+    {
+        return false;
+    }
+    for (const Tank &other : tanks)
+    {
+        if (other.profile == index && other.settingDirty)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Switches a tank to the profile queued for it, loading its setting and batch totals.
+ *
+ * The new setting index is saved in the background.
+ *
+ * @param tank The tank, with nextProfile set.
+ */
+void switchProfile(Tank &tank)
+{
+    tank.profile = tank.nextProfile;
+    tank.nextProfile = NO_PROFILE;
+    loadProfile(tank.profile, tank.setting);
+    loadTotals(tank);
+    tank.session.state = SESSION_IDLE;
+    updateTankGeometry(tank);
+    markSettingsDirty(SETTINGS_KEY_CURRENT);
+    displayDirty = true;
+}
+
+/**
+ * @brief Reads the batch totals of a tank's profile from the EEPROM memory, or starts them at zero.
+ *
+ * @param tank The tank.
+ */
+void loadTotals(Tank &tank)
+{
+    if (!loadSettingsRecord(SETTINGS_KEY_TOTALS + tank.profile, &tank.totals, sizeof(BatchTotals)))
+    {
+        tank.totals = BatchTotals();
+    }
+    tank.totalsDirty = false;
+}
+
+/**
+ * @brief Shows another tank, which the settings screens and commands then act on.
+ *
+ * A pending save of the tank shown carries on in the background, it is written from that tank's setting.
+ * The fill history starts over, it only follows the tank shown.
+ *
+ * @param index The tank index.
+ */
+void selectTank(uint8_t index)
+{
+    currentTank = index;
+    shownScreen = -1;
+    displayDirty = true;
+    resetLog();
+    resetCalibration();
+}
+
+/**
+ * @brief Resets a setting read from EEPROM memory that was never written.
+ *
+ * An erased EEPROM reads as 0xFF, so an unwritten profile has 0xFFFF in every field.
+ * Values outside the range the editor allows are reset as well.
+ *
+ * @param setting The setting to check.
+ */
+void sanitizeSetting(MakgeolliTankSetting &setting)
+{
+    if (setting.minHeight == 0xFFFF || setting.diameter > MAX_DIAMETER || setting.bottomDiameter > MAX_DIAMETER ||
+        setting.temperature < MIN_TEMPERATURE || setting.temperature > MAX_TEMPERATURE || setting.shape >= SHAPE_COUNT)
+    {
+        setting = MakgeolliTankSetting();
+    }
+}
+
+/**
+ * @brief Saves the settings to the EEPROM memory.
+ *
+ * This function queues the setting of the tank shown for saving under its profile index,
+ * and the alarm lead time, which is saved with the indexes.
+ * Other tanks on the same profile take the setting over in RAM.
+ * The records are written in the background by persistSettings().
+ */
+void saveSettings()
+{
+    Tank &shown = tanks[currentTank];
+    shown.settingDirty = true;
+    for (Tank &tank : tanks)
+    {
+        if (&tank != &shown && tank.profile == shown.profile)
+        {
+            tank.setting = shown.setting;
+            updateTankGeometry(tank);
+        }
+    }
+
+    markSettingsDirty(shown.profile);
+    markSettingsDirty(SETTINGS_KEY_CURRENT);
+}
+
+/**
+ * @brief Queues a settings object for writing to the EEPROM memory.
+ *
+ * If the object is already being written, the write restarts so no byte of the old value survives.
+ *
+ * @param key The profile index of a tank with settingDirty, or SETTINGS_KEY_CURRENT for the setting indexes of the tanks.
+ */
+void markSettingsDirty(uint8_t key)
+{
+    settingsDirty |= key == SETTINGS_KEY_CURRENT ? SETTINGS_DIRTY_CURRENT : SETTINGS_DIRTY_PROFILE;
+    if (persistOffset > 0 && persistKey == key)
+    {
+        persistOffset = 0;
+    }
+}
+
+/**
+ * @brief Writes one byte of a pending settings record to the EEPROM memory.
+ *
+ * EEPROM writes take about 3.3 ms per byte, so doing a whole record at once would stall the loop.
+ * Writing one byte per run lets the previous write finish in the background.
+ * Unchanged bytes are skipped without a write cycle.
+ *
+ * Each save appends a new record to the next free slot of the log instead of overwriting the old one,
+ * which spreads the wear over all slots. The record's CRC is written last and the previous record
+ * stays intact until the new one is complete, so a torn write just leaves the old value in effect.
+ * The batch totals of a profile are records as well, saved TOTALS_SAVE_DELAY after they first changed,
+ * or at once for a tank waiting to switch its profile, which is switched here once canSwitchProfile() allows it.
+ * Bytes staged by a geometry table upload, then hour records of the fill history, are written the same way
+ * once no settings record is pending.
+ */
+void persistSettings()
+{
+    for (Tank &tank : tanks)
+    {
+        if (tank.nextProfile != NO_PROFILE && canSwitchProfile(tank))
+        {
+            switchProfile(tank);
+        }
+        if (tank.settingDirty)
+        {
+            settingsDirty |= SETTINGS_DIRTY_PROFILE;
+        }
+        if (tank.totalsDirty && (tank.nextProfile != NO_PROFILE || millis() - tank.totalsChanged >= TOTALS_SAVE_DELAY))
+        {
+            settingsDirty |= SETTINGS_DIRTY_TOTALS;
+        }
+    }
+
+    if (!settingsDirty)
+    {
+        if (stagedLength > 0)
+        {
+            persistStagedBytes();
+        }
+        else
+        {
+            persistLogRecord();
+        }
+        return;
+    }
+
+    if (persistOffset == 0)
+    {
+        if (settingsDirty & SETTINGS_DIRTY_PROFILE)
+        {
+            persistBit = SETTINGS_DIRTY_PROFILE;
+        }
+        else if (settingsDirty & SETTINGS_DIRTY_CURRENT)
+        {
+            persistKey = SETTINGS_KEY_CURRENT;
+            persistBit = SETTINGS_DIRTY_CURRENT;
+        }
+        else if (settingsDirty & SETTINGS_DIRTY_UPLOAD)
+        {
+            persistKey = uploadKey;
+            persistBit = SETTINGS_DIRTY_UPLOAD;
+        }
+        else
+        {
+            persistBit = SETTINGS_DIRTY_TOTALS;
+        }
+
+        memset(&pendingRecord, 0, sizeof(pendingRecord));
+        pendingRecord.sequence = nextSequence;
+        if (persistBit == SETTINGS_DIRTY_PROFILE)
+        {
+            // The setting is copied here too, so the tank can be edited again or switched during the write
+            Tank *tank = NULL;
+            for (Tank &candidate : tanks)
+            {
+                if (candidate.settingDirty)
+                {
+                    tank = &candidate;
+                    break;
+                }
+            }
+            if (!tank)
+            {
+                settingsDirty &= ~SETTINGS_DIRTY_PROFILE;
+                return;
+            }
+            persistKey = tank->profile;
+            memcpy(pendingRecord.data, &tank->setting, sizeof(MakgeolliTankSetting));
+            tank->settingDirty = false;
+        }
+        else if (persistBit == SETTINGS_DIRTY_TOTALS)
+        {
+            // The totals are copied here, so a batch ending during the write is saved with the next record
+            Tank *tank = NULL;
+            for (Tank &candidate : tanks)
+            {
+                if (candidate.totalsDirty)
+                {
+                    tank = &candidate;
+                    break;
+                }
+            }
+            if (!tank)
+            {
+                settingsDirty &= ~SETTINGS_DIRTY_TOTALS;
+                return;
+            }
+            persistKey = SETTINGS_KEY_TOTALS + tank->profile;
+            memcpy(pendingRecord.data, &tank->totals, sizeof(BatchTotals));
+            tank->totalsDirty = false;
+        }
+        else if (persistKey == SETTINGS_KEY_CURRENT)
+        {
+            pendingRecord.data[0] = tanks[0].profile;
+            pendingRecord.data[1] = alarmLead;
+            for (uint8_t i = 1; i < TANK_COUNT; i++)
+            {
+                pendingRecord.data[1 + i] = tanks[i].profile;
+            }
+        }
+        else
+        {
+            memcpy(pendingRecord.data, &uploadSetting, sizeof(MakgeolliTankSetting));
+        }
+        pendingRecord.key = persistKey;
+        pendingRecord.crc = crc8(reinterpret_cast<const uint8_t *>(&pendingRecord), SETTINGS_RECORD_SIZE - 1);
+
+        persistSlot = findFreeSlot();
+    }
+
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&pendingRecord);
+    updateEepromByte(SETTINGS_LOG_ADDRESS + persistSlot * SETTINGS_RECORD_SIZE + persistOffset, bytes[persistOffset]);
+    persistOffset++;
+
+    if (persistOffset >= SETTINGS_RECORD_SIZE)
+    {
+        recordSlots[persistKey] = persistSlot;
+        nextSlot = (persistSlot + 1) % SETTINGS_LOG_SLOTS;
+        nextSequence++;
+        settingsDirty &= ~persistBit;
+        persistOffset = 0;
+    }
+}
+
+/**
+ * @brief Writes one staged byte to the EEPROM memory.
+ *
+ * The geometry is rebuilt once all staged bytes are written, in case they changed the table of a tank's profile.
+ */
+void persistStagedBytes()
+{
+    if (stagedLength == 0)
+    {
+        return;
+    }
+
+    updateEepromByte(stagedAddress + stagedOffset, stagedSource[stagedOffset]);
+    stagedOffset++;
+
+    if (stagedOffset >= stagedLength)
+    {
+        stagedLength = 0;
+        for (Tank &tank : tanks)
+        {
+            updateTankGeometry(tank);
+        }
+    }
+}
+
+/**
+ * @brief Writes a byte to the EEPROM memory unless it already holds it, counting the writes.
+ *
+ * @param address The EEPROM address.
+ * @param value The byte.
+ */
+void updateEepromByte(uint16_t address, uint8_t value)
+{
+    if (EEPROM.read(address) != value)
+    {
+        EEPROM.write(address, value);
+        stats.eepromWrites++;
+    }
+}
+
+/**
+ * @brief Finds the slot the next settings record goes into.
+ *
+ * Slots are used round-robin, skipping the ones that hold the latest record of a key,
+ * so every key always has one intact record.
+ *
+ * @return The slot index.
+ */
+uint8_t findFreeSlot()
+{
+    uint8_t slot = nextSlot;
+    for (;;)
+    {
+        bool live = false;
+        for (uint8_t key = 0; key < SETTINGS_KEYS; key++)
+        {
+            if (recordSlots[key] == slot)
+            {
+                live = true;
+            }
+        }
+        if (!live)
+        {
+            return slot;
+        }
+        slot = (slot + 1) % SETTINGS_LOG_SLOTS;
+    }
+}
+
+/**
+ * @brief Scans the settings log for the latest valid record of every key.
+ *
+ * Called once at boot. Records with a bad CRC, from a torn write or an erased EEPROM, are ignored.
+ * Writing resumes after the newest record found.
+ */
+void scanSettingsLog()
+{
+    bool found = false;
+    uint16_t newest = 0;
+    for (uint8_t key = 0; key < SETTINGS_KEYS; key++)
+    {
+        recordSlots[key] = NO_SLOT;
+    }
+
+    for (uint8_t slot = 0; slot < SETTINGS_LOG_SLOTS; slot++)
+    {
+        SettingsRecord record;
+        if (!readSettingsRecord(slot, record))
+        {
+            continue;
+        }
+
+        uint8_t latest = recordSlots[record.key];
+        if (latest == NO_SLOT || (int16_t)(record.sequence - slotSequence(latest)) > 0)
+        {
+            recordSlots[record.key] = slot;
+        }
+        if (!found || (int16_t)(record.sequence - newest) > 0)
+        {
+            found = true;
+            newest = record.sequence;
+            nextSlot = (slot + 1) % SETTINGS_LOG_SLOTS;
+        }
+    }
+    nextSequence = newest + 1;
+}
+
+/**
+ * @brief Reads the data of the latest record of a key from the settings log.
+ *
+ * @param key The profile index, or SETTINGS_KEY_CURRENT for the current setting index.
+ * @param data Where to copy the record data.
+ * @param size The number of bytes to copy, at most SETTINGS_DATA_SIZE.
+ * @return True if the key has a valid record.
+ */
+bool loadSettingsRecord(uint8_t key, void *data, uint8_t size)
+{
+    SettingsRecord record;
+    if (recordSlots[key] == NO_SLOT || !readSettingsRecord(recordSlots[key], record))
+    {
+        return false;
+    }
+    memcpy(data, record.data, size);
+    return true;
+}
+
+/**
+ * @brief Reads a record from the settings log and checks it.
+ *
+ * @param slot The slot index.
+ * @param record The record to fill.
+ * @return True if the record has a known key and a matching CRC.
+ */
+bool readSettingsRecord(uint8_t slot, SettingsRecord &record)
+{
+    EEPROM.get(SETTINGS_LOG_ADDRESS + slot * SETTINGS_RECORD_SIZE, record);
+    return record.key < SETTINGS_KEYS &&
+           record.crc == crc8(reinterpret_cast<const uint8_t *>(&record), SETTINGS_RECORD_SIZE - 1);
+}
+
+/**
+ * @brief Returns the sequence number of the record in a slot.
+ *
+ * @param slot The slot index.
+ * @return The sequence number.
+ */
+uint16_t slotSequence(uint8_t slot)
+{
+    uint16_t sequence;
+    EEPROM.get(SETTINGS_LOG_ADDRESS + slot * SETTINGS_RECORD_SIZE, sequence);
+    return sequence;
+}
+
+/**
+ * @brief Computes the CRC-8 (polynomial 0x07) of a block of bytes.
+ *
+ * @param data The bytes to check.
+ * @param length The number of bytes.
+ * @return The CRC.
+ */
+uint8_t crc8(const uint8_t *data, uint8_t length)
+{
+    uint8_t crc = 0;
+    while (length--)
+    {
+        crc ^= *data++;
+        for (uint8_t i = 0; i < 8; i++)
+        {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+/**
+ * @brief Streams a sample and the state derived from it to the serial port.
+ *
+ * One TelemetryRecord is sent per ping, framed by sendFrame(). If the record does not fit into the
+ * transmit buffer it is dropped, so a slow link or a low baud rate never holds up the sensing loop.
+ *
+ * @param index The index of the tank the sample is of.
+ * @param echoTime The raw round-trip echo time in microseconds, or NO_ECHO.
+ * @param valid False if the echo was missing or out of range and was left out of the filters.
+ * @param time The time in milliseconds the sample was taken.
+ */
+void sendTelemetry(uint8_t index, uint16_t echoTime, bool valid, unsigned long time)
+{
+    if (!telemetryEnabled)
+    {
+        return;
+    }
+
+    const Tank &tank = tanks[index];
+    TelemetryRecord record;
+    record.time = time;
+    record.volume = currentVolume(tank);
+    record.echoTime = echoTime;
+    uint16_t distance = filteredDistance(tank);
+    record.height = distance < tank.setting.minHeight ? tank.setting.minHeight - distance : 0;
+    record.type = FRAME_TELEMETRY;
+    record.sequence = telemetrySequence++;
+    record.profile = tank.profile;
+    record.flags = tankFlags(index) | (valid ? 0 : TELEMETRY_INVALID_ECHO);
+
+    if (!sendFrame(&record, sizeof(record)))
+    {
+        telemetryDropped++;
+    }
+}
+
+/**
+ * @brief Gets the state flags of a tank as the telemetry and the uplink report them.
+ *
+ * @param index The index of the tank.
+ * @return TELEMETRY_CUTOFF, TELEMETRY_ALARM and TELEMETRY_VALID, with the tank in the upper four bits.
+ */
+uint8_t tankFlags(uint8_t index)
+{
+    const Tank &tank = tanks[index];
+    return (tank.fillCutoff ? TELEMETRY_CUTOFF : 0) | (tank.prediction.alarm ? TELEMETRY_ALARM : 0) |
+           (tank.geometry.configured && tank.estimate.valid ? TELEMETRY_VALID : 0) | index << TELEMETRY_TANK_SHIFT;
+}
+
+/**
+ * @brief Sends a binary frame over the serial port without blocking.
+ *
+ * @param data The payload, at most FRAME_MAX_PAYLOAD bytes, starting with the frame type.
+ * @param length The number of payload bytes.
+ * @return True if the frame was queued, false if there was no room for it.
+ */
+bool sendFrame(const void *data, uint8_t length)
+{
+    return writeFrame(Serial, data, length);
+}
+
+/**
+ * @brief Sends a binary frame over a serial port without blocking.
+ *
+ * The payload is followed by its CRC-16, COBS encoded so it holds no zero bytes, and ended with a zero byte,
+ * which lets the host find the start of the next frame after a lost byte.
+ * The frame is written only if it fits into the transmit buffer as a whole; the UART interrupt sends it from there.
+ *
+ * @param port The serial port, Serial or the uplink.
+ * @param data The payload, at most FRAME_MAX_PAYLOAD bytes, starting with the frame type.
+ * @param length The number of payload bytes.
+ * @return True if the frame was queued, false if there was no room for it.
+ */
+bool writeFrame(HardwareSerial &port, const void *data, uint8_t length)
+{
+    uint8_t payload[FRAME_MAX_PAYLOAD + 2];
+    uint8_t frame[FRAME_MAX_PAYLOAD + 4];
+
+    memcpy(payload, data, length);
+    uint16_t crc = crc16(payload, length);
+    payload[length++] = crc & 0xFF;
+    payload[length++] = crc >> 8;
+
+    uint8_t size = cobsEncode(payload, length, frame);
+    frame[size++] = 0;
+
+    if (port.availableForWrite() < size)
+    {
+        return false;
+    }
+    port.write(frame, size);
+    return true;
+}
+
+/**
+ * @brief COBS encodes a block of bytes.
+ *
+ * Every zero byte is replaced by the distance to the next one, so the encoded block holds no zeros.
+ *
+ * @param data The bytes to encode, fewer than 254.
+ * @param length The number of bytes.
+ * @param encoded Where to write the encoded bytes, length + 1 of them.
+ * @return The number of encoded bytes.
+ */
+uint8_t cobsEncode(const uint8_t *data, uint8_t length, uint8_t *encoded)
+{
+    uint8_t code = 1;
+    uint8_t codeIndex = 0;
+    uint8_t size = 1;
+
+    for (uint8_t i = 0; i < length; i++)
+    {
+        if (data[i] == 0)
+        {
+            encoded[codeIndex] = code;
+            codeIndex = size++;
+            code = 1;
+        }
+        else
+        {
+            encoded[size++] = data[i];
+            code++;
+        }
+    }
+    encoded[codeIndex] = code;
+    return size;
+}
+
+/**
+ * @brief Computes the CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF) of a block of bytes.
+ *
+ * @param data The bytes to check.
+ * @param length The number of bytes.
+ * @return The CRC.
+ */
+uint16_t crc16(const uint8_t *data, uint16_t length)
+{
+    uint16_t crc = 0xFFFF;
+    while (length--)
+    {
+        crc ^= (uint16_t)*data++ << 8;
+        for (uint8_t i = 0; i < 8; i++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Receives command frames from the serial port and answers them.
+ *
+ * Polled from the scheduler, so it only takes what the receive buffer already holds and never waits for more.
+ * Frames are collected up to their zero byte, COBS decoded and checked against their CRC-16 as sendFrame()
+ * builds them; anything damaged or too long is dropped and the host times out and sends it again.
+ * A dump in progress sends as many of its frames as fit into the transmit buffer.
+ */
+void pollCommands()
+{
+    while (Serial.available() > 0)
+    {
+        uint8_t c = Serial.read();
+        if (c != 0)
+        {
+            if (commandLength < COMMAND_BUFFER_SIZE)
+            {
+                commandBuffer[commandLength] = c;
+            }
+            if (commandLength <= COMMAND_BUFFER_SIZE)
+            {
+                commandLength++;
+            }
+            continue;
+        }
+
+        if (commandLength > 0 && commandLength <= COMMAND_BUFFER_SIZE)
+        {
+            uint8_t size = cobsDecode(commandBuffer, commandLength, commandBuffer);
+            if (size > 2 && crc16(commandBuffer, size - 2) == (commandBuffer[size - 2] | commandBuffer[size - 1] << 8))
+            {
+                handleCommand(commandBuffer, size - 2);
+            }
+        }
+        commandLength = 0;
+    }
+
+    while (dumpItem < DUMP_ITEMS && sendDumpItem(dumpItem))
+    {
+        dumpItem++;
+    }
+    if (dumpItem == DUMP_ITEMS && sendAck(CMD_DUMP, STATUS_OK))
+    {
+        dumpItem = NO_DUMP;
+    }
+
+    while (logDumpItem < LOG_DUMP_ITEMS && sendLogDumpItem(logDumpItem))
+    {
+        logDumpItem++;
+    }
+    if (logDumpItem == LOG_DUMP_ITEMS && sendAck(CMD_DUMP_LOG, STATUS_OK))
+    {
+        logDumpItem = NO_LOG_DUMP;
+    }
+}
+
+/**
+ * @brief Runs a command received over the serial port.
+ *
+ * Writes to the EEPROM memory are only queued, for persistSettings() to do in the background,
+ * and a command that needs a queue that is still busy is answered with STATUS_BUSY.
+ *
+ * @param command The decoded frame, starting with the command byte.
+ * @param length The number of bytes, without the CRC.
+ */
+void handleCommand(const uint8_t *command, uint8_t length)
+{
+    uint8_t status = STATUS_BAD;
+    uint8_t index = length > 1 ? command[1] : 0;
+
+    switch (command[0])
+    {
+    case CMD_GET_PROFILE:
+        if (length == 2 && index < PROFILE_COUNT)
+        {
+            sendProfile(index);
+            return;
+        }
+        break;
+    case CMD_SET_PROFILE:
+        if (length == 2 + sizeof(MakgeolliTankSetting) && index < PROFILE_COUNT)
+        {
+            status = uploadProfile(index, command + 2);
+        }
+        break;
+    case CMD_GET_FIELD:
+        if (length == 2 && index < ITEM_COUNT(editItems))
+        {
+            sendField(index);
+            return;
+        }
+        break;
+    case CMD_SET_FIELD:
+        if (length == 4 && index < ITEM_COUNT(editItems))
+        {
+            status = setField(index, command[2] | command[3] << 8);
+        }
+        break;
+    case CMD_SELECT:
+        if (length == 2 && index < PROFILE_COUNT)
+        {
+            selectProfile(index);
+            status = STATUS_OK;
+        }
+        break;
+    case CMD_CAPTURE:
+        if (length == 1 && filteredDistance(tanks[currentTank]) == NO_ECHO)
+        {
+            status = STATUS_BUSY;
+        }
+        else if (length == 1)
+        {
+            captureMinHeight();
+            saveSettings();
+            status = STATUS_OK;
+        }
+        break;
+    case CMD_SET_POINT:
+        if (length == 3 + sizeof(GeometryPoint) && index < GEOMETRY_TABLE_COUNT && command[2] < GEOMETRY_TABLE_SIZE)
+        {
+            uint16_t address = GEOMETRY_TABLE_ADDRESS + index * sizeof(GeometryTable) +
+                               offsetof(GeometryTable, points) + command[2] * sizeof(GeometryPoint);
+            status = stageBytes(address, command + 3, sizeof(GeometryPoint));
+        }
+        break;
+    case CMD_SET_POINTS:
+        if (length == 3 && index < GEOMETRY_TABLE_COUNT && command[2] <= GEOMETRY_TABLE_SIZE)
+        {
+            status = stageBytes(GEOMETRY_TABLE_ADDRESS + index * sizeof(GeometryTable), command + 2, 1);
+        }
+        break;
+    case CMD_DUMP:
+        if (length == 1)
+        {
+            dumpItem = 0;
+            return;
+        }
+        break;
+    case CMD_DUMP_LOG:
+        if (length == 1)
+        {
+            logDumpItem = 0;
+            return;
+        }
+        break;
+    case CMD_TELEMETRY:
+        if (length == 2 && index <= 1)
+        {
+            telemetryEnabled = index;
+            status = STATUS_OK;
+        }
+        break;
+    case CMD_TANK:
+        if (length == 2 && index < TANK_COUNT)
+        {
+            selectTank(index);
+            status = STATUS_OK;
+        }
+        break;
+    case CMD_STATS:
+        if (length == 1)
+        {
+            sendStats();
+            return;
+        }
+        break;
+    case CMD_TIMINGS:
+        if (length == 1)
+        {
+            sendTimings();
+            return;
+        }
+        break;
+    }
+    sendAck(command[0], status);
+}
+
+/**
+ * @brief Stores a profile received over the serial port.
+ *
+ * The profile of the tank shown is replaced in RAM and saved like an edit, any other one is queued as an upload
+ * and replaced in RAM for the tanks using it.
+ *
+ * @param index The profile index.
+ * @param data The MakgeolliTankSetting as sent.
+ * @return STATUS_OK, or STATUS_BUSY if the previous upload has not been written yet.
+ */
+uint8_t uploadProfile(uint8_t index, const uint8_t *data)
+{
+    MakgeolliTankSetting setting;
+    memcpy(&setting, data, sizeof(setting));
+    sanitizeSetting(setting);
+
+    Tank &shown = tanks[currentTank];
+    if (index == shown.profile)
+    {
+        shown.setting = setting;
+        updateTankGeometry(shown);
+        saveSettings();
+        return STATUS_OK;
+    }
+
+    if (settingsDirty & SETTINGS_DIRTY_UPLOAD)
+    {
+        return STATUS_BUSY;
+    }
+    uploadKey = index;
+    uploadSetting = setting;
+    settingsDirty |= SETTINGS_DIRTY_UPLOAD;
+
+    for (Tank &tank : tanks)
+    {
+        if (tank.profile == index)
+        {
+            tank.setting = setting;
+            updateTankGeometry(tank);
+        }
+    }
+    return STATUS_OK;
+}
+
+/**
+ * @brief Sets a field of the profile of the tank shown through its edit settings row and saves the profile.
+ *
+ * The row's range and change hook apply just as for the buttons.
+ *
+ * @param row The edit settings row.
+ * @param raw The new value as sent, read as signed only for a VALUE_INT8 row so uint16_t fields get their full range.
+ * @return STATUS_OK, or STATUS_BAD if the row has no value or the value is out of range.
+ */
+uint8_t setField(uint8_t row, uint16_t raw)
+{
+    MenuItem item;
+    memcpy_P(&item, &editItems[row], sizeof(MenuItem));
+    long value = item.type == VALUE_INT8 ? (long)(int16_t)raw : (long)raw;
+    if (item.type == VALUE_NONE || value < item.minimum || value > (long)item.maximum)
+    {
+        return STATUS_BAD;
+    }
+
+    writeItemValue(item, value);
+    if (item.changed)
+    {
+        item.changed();
+    }
+    saveSettings();
+    displayDirty = true;
+    return STATUS_OK;
+}
 
-struct MakgeolliTankSetting
+/**
+ * @brief Queues bytes for persistSettings() to write to the EEPROM memory.
+ *
+ * @param address The EEPROM address.
+ * @param data The bytes, at most sizeof(stagedData).
+ * @param length The number of bytes.
+ * @return STATUS_OK, or STATUS_BUSY if the previous bytes have not been written yet.
+ */
+uint8_t stageBytes(uint16_t address, const uint8_t *data, uint8_t length)
 {
-    float minHeight = 0;
-    float diameter = 0;
-    float targetCapacity = 0;
-};
-
-MakgeolliTankSetting settings[5];
-int currentSettingAddress = 5 * sizeof(MakgeolliTankSetting);
-int currentSetting = 0;
-int currentScreen = MAIN_SCREEN;
-int menuItem = 0;
+    if (stagedLength > 0)
+    {
+        return STATUS_BUSY;
+    }
+    stagedAddress = address;
+    memcpy(stagedData, data, length);
+    stagedSource = stagedData;
+    stagedOffset = 0;
+    stagedLength = length;
+    return STATUS_OK;
+}
 
 /**
- * @brief Initializes the necessary components and settings for the program.
+ * @brief Sends one frame of a dump: a profile, the point count of a geometry table or one of its points.
  *
- * This function is called once at the beginning of the program.
- * It sets up the serial communication, pin modes for buttons and sensors,
- * and initializes the display.
+ * @param item The item, profiles first, then each table's count followed by its points.
+ * @return True if the frame was queued.
  */
-void setup()
+bool sendDumpItem(uint8_t item)
 {
-    Serial.begin(9600);
+    if (item < PROFILE_COUNT)
+    {
+        return sendProfile(item);
+    }
+    item -= PROFILE_COUNT;
 
-    pinMode(BUTTON_UP_PIN, INPUT_PULLUP);
-    pinMode(BUTTON_DOWN_PIN, INPUT_PULLUP);
-    pinMode(BUTTON_LEFT_PIN, INPUT_PULLUP);
-    pinMode(BUTTON_RIGHT_PIN, INPUT_PULLUP);
-    pinMode(BUTTON_SELECT_PIN, INPUT_PULLUP);
+    uint8_t table = item / (1 + GEOMETRY_TABLE_SIZE);
+    uint8_t point = item % (1 + GEOMETRY_TABLE_SIZE);
+    uint16_t address = GEOMETRY_TABLE_ADDRESS + table * sizeof(GeometryTable);
 
-    display.begin(SSD1306_SWITCHCAPVCC, 0x3D);
-    display.clearDisplay();
+    if (point == 0)
+    {
+        uint8_t frame[] = {FRAME_TABLE, table, EEPROM.read(address)};
+        return sendFrame(frame, sizeof(frame));
+    }
 
-    EEPROM.get(currentSettingAddress, currentSetting);
+    uint8_t frame[3 + sizeof(GeometryPoint)] = {FRAME_POINT, table, (uint8_t)(point - 1)};
+    GeometryPoint stored;
+    EEPROM.get(address + offsetof(GeometryTable, points) + (point - 1) * sizeof(GeometryPoint), stored);
+    memcpy(frame + 3, &stored, sizeof(stored));
+    return sendFrame(frame, sizeof(frame));
+}
 
-    // If there is garbage value in the initial value when booting after the initial ROM write, set the initial value and save it to EEPROM
-    if (currentSetting < 0 || currentSetting >= 5)
+/**
+ * @brief Sends a profile, from RAM if it is the one of the tank shown and from the EEPROM memory otherwise.
+ *
+ * @param index The profile index.
+ * @return True if the frame was queued.
+ */
+bool sendProfile(uint8_t index)
+{
+    const Tank &tank = tanks[currentTank];
+    MakgeolliTankSetting setting = tank.setting;
+    if (index != tank.profile)
     {
-        currentSetting = 0; // 초기값
-        EEPROM.put(currentSettingAddress, currentSetting);
+        loadProfile(index, setting);
     }
 
-    loadSettings();
+    uint8_t frame[2 + sizeof(MakgeolliTankSetting)] = {FRAME_PROFILE, index};
+    memcpy(frame + 2, &setting, sizeof(setting));
+    return sendFrame(frame, sizeof(frame));
 }
 
 /**
- * @brief The main loop function that runs repeatedly in the program.
+ * @brief Sends the value of an edit settings row.
  *
- * This function handles buttons, updates the display, pings the sonar, and introduces a delay of 100 milliseconds.
+ * @param row The edit settings row.
+ * @return True if the frame was queued.
  */
-void loop()
+bool sendField(uint8_t row)
 {
-    handleButtons();
-    updateDisplay();
-    delay(100);
+    MenuItem item;
+    memcpy_P(&item, &editItems[row], sizeof(MenuItem));
+    int16_t value = readItemValue(item);
+
+    uint8_t frame[] = {FRAME_FIELD, row, (uint8_t)(value & 0xFF), (uint8_t)(value >> 8)};
+    return sendFrame(frame, sizeof(frame));
 }
 
 /**
- * @brief Handles the button inputs and performs corresponding actions based on the current screen.
+ * @brief Sends the counters of stats, then starts its maxima over, so each read covers the time since the last.
  *
- * This function reads the state of the buttons and performs different actions depending on the current screen.
- * It checks if any button is pressed and updates the current screen and menu item accordingly.
- *
- * @note This function assumes that the button pins are defined and the necessary libraries are included.
+ * @return True if the frame was queued.
  */
-void handleButtons()
+bool sendStats()
 {
-    // Read the state of the buttons
-    bool up = !digitalRead(BUTTON_UP_PIN);
-    bool down = !digitalRead(BUTTON_DOWN_PIN);
-    bool left = !digitalRead(BUTTON_LEFT_PIN);
-    bool right = !digitalRead(BUTTON_RIGHT_PIN);
-    bool select = !digitalRead(BUTTON_SELECT_PIN);
-    bool anyButtonPressed = up || down || select;
-
-    switch (currentScreen)
+    uint16_t missedDeadlines = 0;
+    for (const Task &task : tasks)
     {
-    case MAIN_SCREEN:
-        if (select)
-        {
-            currentScreen = MENU_SCREEN;
-            menuItem = -1;
-        }
-        break;
-    case MENU_SCREEN:
-        // up and down to navigate menu
-        if (up)
-        {
-            menuItem = (menuItem + 3) % 4;
-        }
-        if (down)
-        {
-            menuItem = (menuItem + 1) % 4;
-        }
-        // select to execute menu action
-        if (select)
-        {
-            executeMenuAction();
-        }
-        break;
-    case VIEW_SCREEN:
-        // select to go back to main screen
-        if (select)
-        {
-            currentScreen = MENU_SCREEN;
-        }
-        break;
-    case SETTINGS_SCREEN:
-        // up and down to navigate menu
-        if (up)
-        {
-            menuItem = (menuItem + 3) % 4;
-        }
-        if (down)
-        {
-            menuItem = (menuItem + 1) % 4;
-        }
-        if (menuItem == 0)
-        {
-            // select to adjust setting
-            if (select)
-            {
-                adjustSetting(true);
-            }
-        }
-        else if (menuItem < 3)
-        {
-            // select to adjust setting
-            if (left)
-            {
-                adjustSetting(false);
-            }
-            else if (right)
-            {
-                adjustSetting(true);
-            }
-        }
-        else
-        {
-            if (select)
-            {
-                saveSettings(currentSetting);
-                currentScreen = MENU_SCREEN;
-                menuItem = -1;
-            }
-        }
-        break;
-    case LOAD_SCREEN:
-        // up and down to navigate menu
-        if (up)
-        {
-            menuItem = (menuItem + 1) % 2;
-        }
-        if (down)
-        {
-            menuItem = (menuItem + 1) % 2;
-        }
+        missedDeadlines += task.missedDeadlines;
+    }
 
-        if (menuItem == 0)
-        {
-            // select to adjust setting
-            if (left)
-            {
-                adjustCurrentSettingIndex(false);
-            }
-            else if (right)
-            {
-                adjustCurrentSettingIndex(true);
-            }
-        }
-        else
-        {
-            if (select)
-            {
-                EEPROM.put(currentSettingAddress, currentSetting);
-                loadSettings();
-                currentScreen = MENU_SCREEN;
-                menuItem = -1;
-            }
-        }
-        break;
+    uint8_t frame[1 + sizeof(Stats) + 4] = {FRAME_STATS};
+    memcpy(frame + 1, &stats, sizeof(Stats));
+    memcpy(frame + 1 + sizeof(Stats), &telemetryDropped, 2);
+    memcpy(frame + 3 + sizeof(Stats), &missedDeadlines, 2);
+    if (!sendFrame(frame, sizeof(frame)))
+    {
+        return false;
     }
+    stats.maxLoopTime = 0;
+    stats.maxInputLatency = 0;
+    return true;
 }
 
 /**
- * @brief Executes the menu action based on the selected menu item.
+ * @brief Sends the minimum, mean and maximum of every timed section and the free SRAM low-water, then starts
+ * the timings over.
  *
- * This function changes the current screen based on the selected menu item.
+ * @return True if the frame was queued.
  */
-void executeMenuAction()
+bool sendTimings()
 {
-    switch (menuItem)
+    uint16_t values[TIMING_SECTIONS * 3 + 1];
+    for (uint8_t i = 0; i < TIMING_SECTIONS; i++)
     {
-    case 0:
-        currentScreen = MAIN_SCREEN;
-        break;
-    case 1:
-        currentScreen = VIEW_SCREEN;
-        break;
-    case 2:
-        currentScreen = SETTINGS_SCREEN;
-        break;
-    case 3:
-        currentScreen = LOAD_SCREEN;
-        break;
+        const SectionTiming &timing = timings[i];
+        values[i * 3] = timing.minimum;
+        values[i * 3 + 1] = timing.count ? timing.total / timing.count : 0;
+        values[i * 3 + 2] = timing.maximum;
     }
-    menuItem = -1;
+    values[TIMING_SECTIONS * 3] = freeStackLowWater();
+
+    uint8_t frame[1 + sizeof(values)] = {FRAME_TIMINGS};
+    memcpy(frame + 1, values, sizeof(values));
+    if (!sendFrame(frame, sizeof(frame)))
+    {
+        return false;
+    }
+    memset(timings, 0, sizeof(timings));
+    return true;
 }
 
 /**
- * @brief Adjusts the setting based on the selected menu item.
+ * @brief Answers a command with its status.
  *
- * This function adjusts the setting based on the selected menu item.
- * It increases or decreases the setting value by 10 units.
- *
- * @param increase A boolean value that indicates whether to increase the setting value.
+ * @param command The command byte.
+ * @param status STATUS_OK, STATUS_BUSY or STATUS_BAD.
+ * @return True if the frame was queued.
  */
-void adjustSetting(bool increase)
+bool sendAck(uint8_t command, uint8_t status)
 {
-    float adjustment = increase ? 10.0f : -10.0f;
-    switch (menuItem)
-    {
-    case 0: // min height
-        settings[currentSetting].minHeight = sonar.ping_cm();
-        break;
-    case 1: // diameter
-        if (isnan(settings[currentSetting].diameter))
-        {
-            settings[currentSetting].diameter = 0;
-        }
+    uint8_t frame[] = {FRAME_ACK, command, status};
+    return sendFrame(frame, sizeof(frame));
+}
 
-        settings[currentSetting].diameter += adjustment;
+/**
+ * @brief Decodes a COBS encoded block of bytes, the reverse of cobsEncode().
+ *
+ * @param encoded The encoded bytes, without the zero that ends the frame.
+ * @param length The number of encoded bytes.
+ * @param data Where to write the decoded bytes, which may be the encoded buffer itself.
+ * @return The number of decoded bytes, 0 if the encoding is broken.
+ */
+uint8_t cobsDecode(const uint8_t *encoded, uint8_t length, uint8_t *data)
+{
+    uint8_t size = 0;
+    uint8_t i = 0;
 
-        if (settings[currentSetting].diameter < 0)
+    while (i < length)
+    {
+        uint8_t code = encoded[i++];
+        if (code == 0 || i + code - 1 > length)
         {
-            settings[currentSetting].diameter = 0;
+            return 0;
         }
-        break;
-    case 2: // target capacity
-        if (isnan(settings[currentSetting].targetCapacity))
+        for (uint8_t j = 1; j < code; j++)
         {
-            settings[currentSetting].targetCapacity = 0;
+            data[size++] = encoded[i++];
         }
-
-        settings[currentSetting].targetCapacity += adjustment;
-
-        if (settings[currentSetting].targetCapacity < 0)
+        if (code < 0xFF && i < length)
         {
-            settings[currentSetting].targetCapacity = 0;
+            data[size++] = 0;
         }
-        break;
     }
+    return size;
 }
 
-void adjustCurrentSettingIndex(bool increase)
+/**
+ * @brief Adds the current volume to the fill history.
+ *
+ * Each sample only updates running minimum, maximum and sum, so the cost per sample is constant.
+ * Every second the mean goes into the seconds ring and every minute the aggregate into the minutes ring,
+ * and after LOG_HOUR_MINUTES minutes the minutes roll up into an hour record for persistSettings() to log.
+ * A period without samples, while the echo is lost or the tank is not set up, is skipped.
+ *
+ * @param time The time in milliseconds the sample was taken.
+ */
+void logSample(unsigned long time)
 {
-    float adjustment = increase ? 1.0f : -1.0f;
-    switch (menuItem)
+    const Tank &tank = tanks[currentTank];
+    if (!tank.geometry.configured || !tank.estimate.valid)
     {
-    case 0: // diameter
-        if (isnan(currentSetting))
-        {
-            currentSetting = 0;
-        }
+        return;
+    }
 
-        currentSetting += adjustment;
+    uint16_t volume = min((currentVolume(tank) + 500) / 1000, 65535UL);
+    accumulate(secondAccumulator, volume);
+    accumulate(minuteAccumulator, volume);
 
-        if (currentSetting < 0)
-        {
-            currentSetting = 0;
-        }
+    if (time - secondStart >= 1000)
+    {
+        logSeconds[logSecondCount % LOG_SECONDS] = secondAccumulator.sum / secondAccumulator.count;
+        logSecondCount++;
+        secondAccumulator.count = 0;
+        secondStart = time - secondStart < 2000 ? secondStart + 1000 : time;
+    }
+
+    if (time - minuteStart < 60000UL)
+    {
+        return;
+    }
+    minuteStart = time - minuteStart < 120000UL ? minuteStart + 60000UL : time;
+
+    LogAggregate &minute = logMinutes[logMinuteCount % LOG_MINUTES];
+    roll(minuteAccumulator, minute);
+    logMinuteCount++;
 
-        if (currentSetting >= 5)
+    hourAccumulator.minimum = hourAccumulator.count ? min(hourAccumulator.minimum, minute.minimum) : minute.minimum;
+    hourAccumulator.maximum = hourAccumulator.count ? max(hourAccumulator.maximum, minute.maximum) : minute.maximum;
+    hourAccumulator.sum += minute.mean;
+    hourAccumulator.count++;
+
+    if (++hourMinutes >= LOG_HOUR_MINUTES)
+    {
+        hourMinutes = 0;
+        if (logWriteOffset < sizeof(LogRecord))
         {
-            currentSetting = 4;
+            hourAccumulator.count = 0; // the previous hour is somehow still being written, so this one is lost
+            hourAccumulator.sum = 0;
+            return;
         }
-        break;
+        pendingLogRecord.sequence = logSequence;
+        pendingLogRecord.minutes = hourAccumulator.count;
+        pendingLogRecord.profile = tank.profile;
+        roll(hourAccumulator, pendingLogRecord.volume);
+        pendingLogRecord.crc = crc8(reinterpret_cast<const uint8_t *>(&pendingLogRecord), offsetof(LogRecord, crc));
+        logWriteOffset = 0;
     }
 }
 
 /**
- * @brief Updates the display based on the current screen.
+ * @brief Starts the fill history over, for another tank.
  *
- * This function clears the display and updates the content based on the current screen.
+ * The minutes of the hour so far are dropped with the rest; an hour record still being written is kept.
  */
-void updateDisplay()
+void resetLog()
 {
-    display.clearDisplay();
-    display.setTextSize(1);
-    display.setTextColor(WHITE);
-    display.setCursor(0, 0);
+    logSecondCount = 0;
+    logMinuteCount = 0;
+    secondAccumulator.count = 0;
+    minuteAccumulator.count = 0;
+    hourAccumulator.count = 0;
+    hourAccumulator.sum = 0;
+    hourMinutes = 0;
+    secondStart = minuteStart = millis();
+}
 
-    switch (currentScreen)
+/**
+ * @brief Adds a value to an accumulator.
+ *
+ * @param accumulator The accumulator, empty if its count is 0.
+ * @param value The value.
+ */
+void accumulate(LogAccumulator &accumulator, uint16_t value)
+{
+    if (accumulator.count == 0)
     {
-    case MAIN_SCREEN:
-        updateMainScreen();
-        break;
-    case MENU_SCREEN:
-        updateMenuScreen();
-        break;
-    case VIEW_SCREEN:
-        updateViewSettingsScreen();
-        break;
-    case SETTINGS_SCREEN:
-        updateEditSettingsScreen();
-        break;
-    case LOAD_SCREEN:
-        updateLoadSettingsScreen();
-        break;
+        accumulator.minimum = value;
+        accumulator.maximum = value;
+        accumulator.sum = 0;
+    }
+    accumulator.minimum = min(accumulator.minimum, value);
+    accumulator.maximum = max(accumulator.maximum, value);
+    accumulator.sum += value;
+    if (accumulator.count < 65535)
+    {
+        accumulator.count++;
     }
-    display.display();
 }
 
 /**
- * @brief Updates the main screen with the current volume of the Makgeolli tank.
+ * @brief Turns an accumulator into an aggregate and empties it.
  *
- * This function calculates the volume of the Makgeolli tank based on the current settings and displays it on the screen.
+ * @param accumulator The accumulator, with at least one value.
+ * @param aggregate The aggregate to fill.
  */
-void updateMainScreen()
+void roll(LogAccumulator &accumulator, LogAggregate &aggregate)
 {
-    float distance = sonar.ping_cm();
-    float height = (settings[currentSetting].minHeight - distance);
-    float volume = (PI * settings[currentSetting].diameter * height) / 1000.0f; // Convert volume from cm^3 to L
+    aggregate.minimum = accumulator.minimum;
+    aggregate.maximum = accumulator.maximum;
+    aggregate.mean = accumulator.count ? accumulator.sum / accumulator.count : 0;
+    accumulator.count = 0;
+    accumulator.sum = 0;
+}
 
-    if (isnan(volume))
+/**
+ * @brief Writes one byte of a pending hour record to the log.
+ *
+ * The log is append-only: records go round-robin into the slots, oldest overwritten first,
+ * and the CRC written last marks a record complete. One hour is one record, so the EEPROM
+ * sees a write cycle per byte per LOG_SLOTS hours.
+ */
+void persistLogRecord()
+{
+    if (logWriteOffset >= sizeof(LogRecord))
     {
-        display.setTextSize(1);
-        display.setCursor(0, 0);
-        display.println("please set up tank");
+        return;
     }
-    else
-    {
-        if (volume < 0)
-        {
-            volume = 0;
-        }
-
-        float remainingCapacity = settings[currentSetting].targetCapacity - volume;
 
-        display.setTextSize(2);
-        display.setCursor((display.width() - 6 * 8) / 2, 15);
-        display.print(volume, 1);
-        display.print(" L");
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&pendingLogRecord);
+    writeLogByte(LOG_ADDRESS + logSlot * sizeof(LogRecord) + logWriteOffset, bytes[logWriteOffset]);
+    logWriteOffset++;
 
-        // Draw progress bar
-        int progressBarWidth = display.width() - 4;
-        int progressBarHeight = 8;
-        int progressBarX = 2;
-        int progressBarY = (display.height() - progressBarHeight) / 2 + 15;
-
-        display.drawRect(progressBarX, progressBarY, progressBarWidth, progressBarHeight, WHITE);
-        int progress = map(volume, 0, settings[currentSetting].targetCapacity, 0, progressBarWidth);
-
-        if(progress > progressBarWidth)
-        {
-          progress = progressBarWidth;
-        }
-
-        display.fillRect(progressBarX, progressBarY, progress, progressBarHeight, WHITE);
-
-        if(remainingCapacity < 0)
-        {
-          display.invertDisplay(true);
-        }
-        else
-        {
-            display.invertDisplay(false);
-        }
-        display.display();
+    if (logWriteOffset >= sizeof(LogRecord))
+    {
+        logSlot = (logSlot + 1) % LOG_SLOTS;
+        logSequence++;
     }
 }
 
 /**
- * @brief Updates the menu screen with the list of menu items.
+ * @brief Finds where the hour log continues after a reset.
  *
- * This function displays the list of menu items on the screen and highlights the selected menu item.
+ * Called once at boot. Writing resumes after the newest valid record.
  */
-void updateMenuScreen()
+void scanHourLog()
 {
-    display.setTextSize(1);
-    display.setCursor((display.width() - (4 * 6)) / 2, 0);
-    display.println("Menu");
-    display.invertDisplay(false);
-
-    display.drawLine(0, 10, display.width(), 10, WHITE);
-
-    const char *menuItems[] = {"Main Screen", "View Settings", "Edit Settings", "Load Settings"};
+    bool found = false;
+    uint16_t newest = 0;
+    logWriteOffset = sizeof(LogRecord);
 
-    for (int i = 0; i < 4; i++)
+    for (uint16_t slot = 0; slot < LOG_SLOTS; slot++)
     {
-        if (i == menuItem)
+        LogRecord record;
+        if (!readLogRecord(slot, record))
         {
-            display.fillRect(0, i * 10 + 11, display.width(), 10, WHITE);
-            display.setTextColor(BLACK, WHITE);
+            continue;
         }
-        else
+        if (!found || (int16_t)(record.sequence - newest) > 0)
         {
-            display.setTextColor(WHITE, BLACK);
+            found = true;
+            newest = record.sequence;
+            logSlot = (slot + 1) % LOG_SLOTS;
         }
-        display.setCursor(0, i * 10 + 11);
-        display.println(menuItems[i]);
     }
-
-    display.display();
+    logSequence = found ? newest + 1 : 0;
 }
 
 /**
- * @brief Updates the view settings screen with the current settings.
+ * @brief Reads a record from the hour log and checks it.
  *
- * This function displays the current settings on the screen.
+ * @param slot The slot index.
+ * @param record The record to fill.
+ * @return True if the CRC matches.
  */
-void updateViewSettingsScreen()
+bool readLogRecord(uint16_t slot, LogRecord &record)
 {
-    display.setTextSize(1);
-    display.setCursor((display.width() - (13 * 6)) / 2, 0);
-    display.println("View Settings");
-
-    display.drawLine(0, 10, display.width(), 10, WHITE);
+    uint8_t *bytes = reinterpret_cast<uint8_t *>(&record);
+    uint16_t address = LOG_ADDRESS + slot * sizeof(LogRecord);
 
-    display.setCursor(0, 14);
+#ifdef LOG_FRAM_ADDRESS
+    Wire.beginTransmission(LOG_FRAM_ADDRESS);
+    Wire.write(address >> 8);
+    Wire.write(address & 0xFF);
+    Wire.endTransmission(false);
+    Wire.requestFrom((uint8_t)LOG_FRAM_ADDRESS, (uint8_t)sizeof(LogRecord));
+    for (uint8_t i = 0; i < sizeof(LogRecord); i++)
+    {
+        bytes[i] = Wire.read();
+    }
+#else
+    for (uint8_t i = 0; i < sizeof(LogRecord); i++)
+    {
+        bytes[i] = EEPROM.read(address + i);
+    }
+#endif
 
-    display.print("Min Height: ");
-    display.println(static_cast<int>(settings[currentSetting].minHeight));
-    display.print("Diameter: ");
-    display.println(static_cast<int>(settings[currentSetting].diameter));
-    display.print("Target Capacity: ");
-    display.println(static_cast<int>(settings[currentSetting].targetCapacity));
+    return record.crc == crc8(bytes, offsetof(LogRecord, crc));
 }
 
 /**
- * @brief Updates the edit settings screen with the current settings.
+ * @brief Writes a byte of the hour log to the EEPROM memory or the FRAM.
  *
- * This function displays the current settings on the screen and allows the user to edit them.
+ * @param address The address in the log's memory.
+ * @param value The byte.
  */
-void updateEditSettingsScreen()
+void writeLogByte(uint16_t address, uint8_t value)
 {
-    display.setTextSize(1);
-    display.setCursor((display.width() - (13 * 6)) / 2, 0);
-    display.println("Edit Settings");
-
-    display.drawLine(0, 10, display.width(), 10, WHITE);
+#ifdef LOG_FRAM_ADDRESS
+    Wire.beginTransmission(LOG_FRAM_ADDRESS);
+    Wire.write(address >> 8);
+    Wire.write(address & 0xFF);
+    Wire.write(value);
+    Wire.endTransmission();
+#else
+    updateEepromByte(address, value);
+#endif
+}
 
-    const char *menuItems[] = {"Min Height: ", "Diameter:", "Target Capacity:", "Save Settings"};
-    float values[] = {settings[currentSetting].minHeight, settings[currentSetting].diameter, settings[currentSetting].targetCapacity};
+/**
+ * @brief Sends one frame of a log dump: an hour record, a minute aggregate, a second mean or a fill event, oldest first,
+ * or the batch totals of a profile.
+ *
+ * Empty slots are skipped without a frame.
+ *
+ * @param item The item, the log's slots first, then the minutes, the seconds, the events and the profiles' totals.
+ * @return True if the frame was queued or there was nothing to send.
+ */
+bool sendLogDumpItem(uint16_t item)
+{
+    if (item < LOG_SLOTS)
+    {
+        LogRecord record;
+        if (!readLogRecord((logSlot + item) % LOG_SLOTS, record))
+        {
+            return true;
+        }
+        uint8_t frame[1 + offsetof(LogRecord, crc)] = {FRAME_LOG_HOUR};
+        memcpy(frame + 1, &record, offsetof(LogRecord, crc));
+        return sendFrame(frame, sizeof(frame));
+    }
+    item -= LOG_SLOTS;
 
-    for (int i = 0; i < 4; i++)
+    if (item < LOG_MINUTES)
     {
-        if (i == menuItem)
+        uint8_t age = LOG_MINUTES - 1 - item;
+        if (age >= logMinuteCount)
         {
-            display.fillRect(0, i * 10 + 11, display.width(), 10, WHITE);
-            display.setTextColor(BLACK, WHITE);
+            return true;
         }
-        else
+        uint8_t frame[2 + sizeof(LogAggregate)] = {FRAME_LOG_MINUTE, age};
+        memcpy(frame + 2, &logMinutes[(logMinuteCount - 1 - age) % LOG_MINUTES], sizeof(LogAggregate));
+        return sendFrame(frame, sizeof(frame));
+    }
+    item -= LOG_MINUTES;
+
+    if (item < LOG_SECONDS)
+    {
+        uint8_t age = LOG_SECONDS - 1 - item;
+        if (age >= logSecondCount)
         {
-            display.setTextColor(WHITE, BLACK);
+            return true;
         }
-        display.setCursor(0, i * 10 + 11);
-        display.print(menuItems[i]);
-        if (i < 3)
+        uint16_t volume = logSeconds[(logSecondCount - 1 - age) % LOG_SECONDS];
+        uint8_t frame[] = {FRAME_LOG_SECOND, age, (uint8_t)(volume & 0xFF), (uint8_t)(volume >> 8)};
+        return sendFrame(frame, sizeof(frame));
+    }
+    item -= LOG_SECONDS;
+
+    if (item < EVENT_LOG_SIZE)
+    {
+        uint8_t age = EVENT_LOG_SIZE - 1 - item;
+        if (age >= fillEventCount)
         {
-            display.println(static_cast<int>(values[i]));
+            return true;
         }
+        uint8_t frame[2 + sizeof(FillEvent)] = {FRAME_EVENT, age};
+        memcpy(frame + 2, &fillEvents[(fillEventCount - 1 - age) % EVENT_LOG_SIZE], sizeof(FillEvent));
+        return sendFrame(frame, sizeof(frame));
     }
+    item -= EVENT_LOG_SIZE;
 
-    display.display();
+    // Totals of a profile a tank is on are sent from RAM, with what has not been saved yet
+    uint8_t frame[2 + sizeof(BatchTotals)] = {FRAME_TOTALS, (uint8_t)item};
+    BatchTotals totals;
+    if (!loadSettingsRecord(SETTINGS_KEY_TOTALS + item, &totals, sizeof(BatchTotals)))
+    {
+        totals = BatchTotals();
+    }
+    for (const Tank &tank : tanks)
+    {
+        if (tank.profile == item)
+        {
+            totals = tank.totals;
+        }
+    }
+    memcpy(frame + 2, &totals, sizeof(BatchTotals));
+    return sendFrame(frame, sizeof(frame));
 }
 
+#ifdef UPLINK_SERIAL
 /**
- * @brief Updates the load settings screen.
+ * @brief Feeds the radio uplink, polled from the scheduler.
  *
- * This function displays the load settings screen on the display.
+ * Completed batches and new fill events go out first, each only once its frame fits into the transmit buffer of
+ * the uplink, so a slow radio delays them rather than the sensing or the display. Then every tank is sampled
+ * once per UPLINK_FAST_INTERVAL while the level of any of them is moving, and once per UPLINK_SLOW_INTERVAL
+ * otherwise. Missed samples are not caught up on.
  */
-void updateLoadSettingsScreen()
+void updateUplink()
 {
-    display.setTextSize(1);
-    display.setCursor((display.width() - (13 * 6)) / 2, 0);
-    display.println("Load Settings");
-
-    display.drawLine(0, 10, display.width(), 10, WHITE);
-
-    const char *menuItems[] = {"index: ", "Load Settings"};
-    float values[] = {currentSetting};
-
-    for (int i = 0; i < 2; i++)
+    for (Uplink &uplink : uplinks)
     {
-        if (i == menuItem)
+        if (uplink.ready && !sendUplinkBatch(uplink))
         {
-            display.fillRect(0, i * 10 + 11, display.width(), 10, WHITE);
-            display.setTextColor(BLACK, WHITE);
+            return;
         }
-        else
+    }
+
+    // Events overwritten before the radio took them are lost
+    if ((uint16_t)(fillEventCount - uplinkEventCount) > EVENT_LOG_SIZE)
+    {
+        uplinkEventCount = fillEventCount - EVENT_LOG_SIZE;
+    }
+    while (uplinkEventCount != fillEventCount)
+    {
+        uint8_t frame[2 + sizeof(FillEvent)] = {FRAME_UPLINK_EVENT, UPLINK_METER_ID};
+        memcpy(frame + 2, &fillEvents[uplinkEventCount % EVENT_LOG_SIZE], sizeof(FillEvent));
+        if (!writeFrame(UPLINK_SERIAL, frame, sizeof(frame)))
         {
-            display.setTextColor(WHITE, BLACK);
+            return;
         }
-        display.setCursor(0, i * 10 + 11);
-        display.print(menuItems[i]);
-        if (i < 1)
+        uplinkEventCount++;
+    }
+
+    uint16_t interval = UPLINK_SLOW_INTERVAL;
+    for (const Tank &tank : tanks)
+    {
+        if (tank.session.state != SESSION_IDLE || tank.session.direction != SESSION_IDLE)
         {
-            display.println(static_cast<int>(values[i]));
+            interval = UPLINK_FAST_INTERVAL;
         }
     }
 
-    display.display();
+    uint32_t now = millis() / 1000;
+    if (now - uplinkSampleTime < interval)
+    {
+        return;
+    }
+    uplinkSampleTime += interval;
+    if (now - uplinkSampleTime >= interval)
+    {
+        uplinkSampleTime = now;
+    }
+
+    for (uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        addUplinkSample(i, uplinkSampleTime, interval);
+    }
 }
 
 /**
- * @brief Loads the settings from the EEPROM memory.
+ * @brief Adds the volume of a tank to its uplink batch.
  *
- * This function reads the settings from the EEPROM memory and stores them in the settings array.
+ * A sample that does not continue the batch, because it is not one interval after the last, the flags changed or
+ * its delta does not fit, completes the batch and starts the next one. A batch spanning UPLINK_BATCH_TIME is
+ * completed with its last sample, so the dashboard hears from a still tank every few minutes.
+ * The sample is dropped if the completed batch is still waiting for the radio.
+ *
+ * @param index The index of the tank.
+ * @param time The time in seconds since boot of the sample.
+ * @param interval The seconds between samples.
  */
-void loadSettings()
+void addUplinkSample(uint8_t index, uint32_t time, uint16_t interval)
 {
-    for (int i = 0; i < 5; i++)
+    Uplink &uplink = uplinks[index];
+    UplinkBatch &batch = uplink.batch;
+    uint32_t volume = currentVolume(tanks[index]);
+    uint8_t flags = tankFlags(index);
+
+    if (uplink.count > 0 && !uplink.ready)
+    {
+        if (flags == batch.flags && interval == batch.interval && time == batch.time + (uint32_t)uplink.count * interval &&
+            appendUplinkDelta(uplink, (int32_t)(volume - uplink.lastVolume)))
+        {
+            uplink.count++;
+            uplink.lastVolume = volume;
+            uplink.ready = time + interval - batch.time > UPLINK_BATCH_TIME;
+            return;
+        }
+        uplink.ready = true;
+    }
+    if (uplink.ready && !sendUplinkBatch(uplink))
     {
-        EEPROM.get(i * sizeof(MakgeolliTankSetting), settings[i]);
+        return;
     }
+
+    batch.type = FRAME_UPLINK_BATCH;
+    batch.meter = UPLINK_METER_ID;
+    batch.profile = tanks[index].profile;
+    batch.flags = flags;
+    batch.time = time;
+    batch.volume = volume;
+    batch.interval = interval;
+    uplink.length = 0;
+    uplink.count = 1;
+    uplink.lastVolume = volume;
+    uplink.ready = interval >= UPLINK_BATCH_TIME;
 }
 
 /**
- * @brief Saves the settings to the EEPROM memory.
+ * @brief Appends a volume change to an uplink batch as a zigzag varint.
  *
- * This function saves the settings to the EEPROM memory based on the given index.
+ * Zigzag maps small changes of either sign to small numbers, so a still tank costs one byte per sample and a
+ * filling one two or three, in groups of seven bits with the top bit set on all but the last.
+ *
+ * @param uplink The uplink of the tank.
+ * @param delta The change in mL since the last sample.
+ * @return True if it was appended, false if the batch has no room for it.
+ */
+bool appendUplinkDelta(Uplink &uplink, int32_t delta)
+{
+    uint32_t value = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+    uint8_t bytes[UPLINK_MAX_DELTA_BYTES];
+    uint8_t size = 0;
+    do
+    {
+        bytes[size] = value & 0x7F;
+        value >>= 7;
+        if (value)
+        {
+            bytes[size] |= 0x80;
+        }
+        size++;
+    } while (value);
+
+    if (uplink.length + size > UPLINK_DELTA_BYTES)
+    {
+        return false;
+    }
+    memcpy(uplink.batch.deltas + uplink.length, bytes, size);
+    uplink.length += size;
+    return true;
+}
+
+/**
+ * @brief Sends a completed uplink batch, with only the deltas in use.
  *
- * @param index The index of the settings array to save.
+ * @param uplink The uplink of the tank.
+ * @return True if it was sent, and the next sample starts a new batch; false if there was no room for it.
  */
-void saveSettings(int index)
+bool sendUplinkBatch(Uplink &uplink)
 {
-    if (index >= 0 && index < 5)
+    if (!writeFrame(UPLINK_SERIAL, &uplink.batch, offsetof(UplinkBatch, deltas) + uplink.length))
     {
-        EEPROM.put(index * sizeof(MakgeolliTankSetting), settings[index]);
+        return false;
     }
+    uplink.ready = false;
+    uplink.count = 0;
+    return true;
 }
+#endif